@@ -4,24 +4,108 @@
 #include <linux/ioctl.h>
 
 #define DEVICE_NAME "pktstrm"
-#define MAJOR_NUM 75
-#define MAX_PKT_SIZE 4096
-#define MAX_FILE_SIZE 4194304
+#define MAX_PKT_SIZE 1048576
+#define MAX_FILE_SIZE 536870912
 #define PKT_DEFAULT_SIZE 256
 #define FILE_DEFAULT_SIZE 262144
-#define DEVICE_GENERAL_LOCK -1
+#define ATOMIC_DEFAULT_SIZE 4096
+#define SEGMENT_MIN_SIZE 64
+#define SEGMENT_CLASSES 7
+#define PKTSTRM_LANES 4
 
-#define PKTSTRM_IOCTL_SET_MODE_PACKET _IO(MAJOR_NUM, 0)
-#define PKTSTRM_IOCTL_SET_MODE_STREAM _IO(MAJOR_NUM, 1)
-#define PKTSTRM_IOCTL_SET_ACC_BLOCK _IO(MAJOR_NUM, 2)
-#define PKTSTRM_IOCTL_SET_ACC_NO_BLOCK _IO(MAJOR_NUM, 3)
-#define PKTSTRM_IOCTL_SET_PKT_SIZE _IOW(MAJOR_NUM, 4, size_t)
-#define PKTSTRM_IOCTL_SET_FILE_SIZE _IOW(MAJOR_NUM, 5, size_t)
+// type number of the ioctl commands
+#define PKTSTRM_IOCTL_TYPE 75
+
+#define PKTSTRM_IOCTL_SET_MODE_PACKET _IO(PKTSTRM_IOCTL_TYPE, 0)
+#define PKTSTRM_IOCTL_SET_MODE_STREAM _IO(PKTSTRM_IOCTL_TYPE, 1)
+#define PKTSTRM_IOCTL_SET_ACC_BLOCK _IO(PKTSTRM_IOCTL_TYPE, 2)
+#define PKTSTRM_IOCTL_SET_ACC_NO_BLOCK _IO(PKTSTRM_IOCTL_TYPE, 3)
+#define PKTSTRM_IOCTL_SET_PKT_SIZE _IOW(PKTSTRM_IOCTL_TYPE, 4, size_t)
+#define PKTSTRM_IOCTL_SET_FILE_SIZE _IOW(PKTSTRM_IOCTL_TYPE, 5, size_t)
+#define PKTSTRM_IOCTL_SET_ENGINE_LIST _IO(PKTSTRM_IOCTL_TYPE, 6)
+#define PKTSTRM_IOCTL_SET_ENGINE_RING _IO(PKTSTRM_IOCTL_TYPE, 7)
+#define PKTSTRM_IOCTL_SET_SPSC _IOW(PKTSTRM_IOCTL_TYPE, 8, int)
+#define PKTSTRM_IOCTL_RING_WAIT_DATA _IO(PKTSTRM_IOCTL_TYPE, 9)
+#define PKTSTRM_IOCTL_RING_WAIT_SPACE _IOW(PKTSTRM_IOCTL_TYPE, 10, size_t)
+#define PKTSTRM_IOCTL_RING_NOTIFY _IO(PKTSTRM_IOCTL_TYPE, 11)
+#define PKTSTRM_IOCTL_READ_BATCH _IOWR(PKTSTRM_IOCTL_TYPE, 12, pktstrm_batch)
+#define PKTSTRM_IOCTL_SET_READ_LOWAT _IOW(PKTSTRM_IOCTL_TYPE, 13, size_t)
+#define PKTSTRM_IOCTL_SET_WRITE_LOWAT _IOW(PKTSTRM_IOCTL_TYPE, 14, size_t)
+#define PKTSTRM_IOCTL_SET_PREALLOC _IOW(PKTSTRM_IOCTL_TYPE, 15, int)
+#define PKTSTRM_IOCTL_SET_BROADCAST _IOW(PKTSTRM_IOCTL_TYPE, 16, int)
+#define PKTSTRM_IOCTL_SET_ATOMIC_SIZE _IOW(PKTSTRM_IOCTL_TYPE, 17, size_t)
+#define PKTSTRM_IOCTL_SET_NUMA_NODE _IOW(PKTSTRM_IOCTL_TYPE, 18, int)
+#define PKTSTRM_IOCTL_SET_OVERFLOW _IOW(PKTSTRM_IOCTL_TYPE, 19, int)
+#define PKTSTRM_IOCTL_GET_DROPS _IOR(PKTSTRM_IOCTL_TYPE, 20, pktstrm_drops)
+#define PKTSTRM_IOCTL_SET_LANE _IOW(PKTSTRM_IOCTL_TYPE, 21, unsigned int)
+#define PKTSTRM_IOCTL_SET_LANE_RESERVE _IOW(PKTSTRM_IOCTL_TYPE, 22, pktstrm_lane_reserve)
+
+// argument of PKTSTRM_IOCTL_SET_NUMA_NODE placing segments on the node of the reader
+#define PKTSTRM_NUMA_FOLLOW (-1)
 
 typedef unsigned char byte;
 
 typedef enum {PACKET, STREAM} device_mode;
 typedef enum {NON_BLOCK, BLOCK} access_mode;
+typedef enum {LIST, RING} storage_engine;
+
+// what writers do when a minor is full: sleep, fail, or evict old packets
+typedef enum {OVERFLOW_BLOCK, OVERFLOW_FAIL, OVERFLOW_DROP_OLDEST} overflow_policy;
+
+/*
+ * Argument of a batched read: packets are stored back to back in buff and
+ * the length of each one in lengths
+ */
+typedef struct pktstrm_batch {
+	char * buff;
+	size_t size;
+	unsigned int * lengths;
+	unsigned int max_pkts;
+} pktstrm_batch;
+
+/*
+ * Packets and bytes evicted by writers of a minor dropping its oldest data,
+ * since the last PKTSTRM_IOCTL_GET_DROPS
+ */
+typedef struct pktstrm_drops {
+	unsigned long pkts;
+	unsigned long bytes;
+} pktstrm_drops;
+
+/*
+ * Argument of PKTSTRM_IOCTL_SET_LANE_RESERVE: bytes of the file size only
+ * the data of a lane may use
+ */
+typedef struct pktstrm_lane_reserve {
+	unsigned int lane;
+	size_t bytes;
+} pktstrm_lane_reserve;
+
+/*
+ * Control page at offset 0 of a ring engine mapping. Indices are free running
+ * and wrap modulo data_size and pkt_slots, both powers of two. Producer and
+ * consumer indices live on separate cache lines.
+ */
+typedef struct pktstrm_ring_ctrl {
+	// bytes and packets published by the producer
+	unsigned int head __attribute__((aligned(64)));
+	unsigned int pkt_head;
+
+	// bytes and packets released by the consumer
+	unsigned int tail __attribute__((aligned(64)));
+	unsigned int pkt_tail;
+
+	// tasks sleeping in the device, notify when non zero
+	unsigned int read_waiters __attribute__((aligned(64)));
+	unsigned int write_waiters;
+
+	// ring geometry, offsets from the start of the mapping
+	unsigned int data_size;
+	unsigned int pkt_slots;
+	unsigned int capacity;
+	unsigned int lengths_offset;
+	unsigned int data_offset;
+} pktstrm_ring_ctrl;
 
 
 #endif
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "pktstream_core.h"
+#include "pktstream_lib.h"
+
+#define MAX_THREADS 16
+#define DEFAULT_RUN_MS 200
+
+
+/*
+ * Microbenchmark of the queue core in user space.
+ * Producers and consumers follow the sequence the module runs for write and
+ * read: segments are prepared outside any lock, linked holding the tail lock
+ * and consumed holding the head lock, sleeping on wait queues while the
+ * queue is full or empty. Each configuration reports throughput and the
+ * latency percentiles of single writes and reads, waits included.
+ */
+
+typedef struct bench_queue {
+	// queue under test and the locks of its two sides
+	pkt_queue queue;
+	shim_mutex head_lock;
+	shim_mutex tail_lock;
+
+	// readers wait for data, writers for space
+	shim_waitq read_queue;
+	shim_waitq write_queue;
+
+	size_t file_size;
+	size_t pkt_size;
+	device_mode mode;
+
+	// set when the run is over
+	int stop;
+} bench_queue;
+
+typedef struct bench_thread {
+	pthread_t thread;
+	bench_queue * bq;
+	histogram hist;
+
+	// packets and bytes moved by the thread
+	unsigned long pkts;
+	unsigned long bytes;
+} bench_thread;
+
+static const size_t pkt_sizes[] = {64, 256, 1024, 4096, 65536};
+static const int thread_counts[] = {1, 2, 4};
+
+
+
+/*
+ * Segment hooks of the core, no pools outside the module
+ */
+
+segment * pktq_take_segment(pkt_queue * queue, size_t cur_size) {
+	return alloc_segment(cur_size, queue -> node);
+}
+
+void pktq_release_segment(pkt_queue * queue, segment * current_segment) {
+	free_segment(current_segment);
+}
+
+
+
+/*
+ * Helper functions
+ */
+
+static unsigned long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+
+
+/*
+ * Producers and consumers
+ */
+
+/*
+ * write one packet at a time, as a write of pkt_size bytes on the module
+ */
+static void * producer(void * arg) {
+	bench_thread * bt = arg;
+	bench_queue * bq = bt -> bq;
+	segment * first;
+	segment * last;
+	shim_iter from;
+	unsigned long start;
+	byte * buff;
+
+	buff = malloc(bq -> pkt_size);
+	memset(buff, 'p', bq -> pkt_size);
+
+	while (!READ_ONCE(bq -> stop)) {
+		start = now_ns();
+		shim_iter_init(&from, buff, bq -> pkt_size);
+		if (pktq_create_segments(&(bq -> queue), bq -> pkt_size, bq -> pkt_size, &from, &first, &last) != 0)
+			break;
+
+		shim_mutex_lock(&(bq -> tail_lock));
+		while (!pktq_has_space(pktq_queued(&(bq -> queue)), bq -> pkt_size, bq -> file_size) && !READ_ONCE(bq -> stop)) {
+			shim_mutex_unlock(&(bq -> tail_lock));
+			shim_wait_event(&(bq -> write_queue),
+				pktq_has_space(pktq_queued(&(bq -> queue)), bq -> pkt_size, bq -> file_size) || READ_ONCE(bq -> stop));
+			shim_mutex_lock(&(bq -> tail_lock));
+		}
+		if (READ_ONCE(bq -> stop)) {
+			shim_mutex_unlock(&(bq -> tail_lock));
+			pktq_release_chain(&(bq -> queue), first);
+			break;
+		}
+		pktq_append(&(bq -> queue), 0, first, last, bq -> pkt_size);
+		shim_mutex_unlock(&(bq -> tail_lock));
+		shim_wake_up(&(bq -> read_queue));
+
+		hist_record(&(bt -> hist), now_ns() - start);
+		bt -> pkts++;
+		bt -> bytes += bq -> pkt_size;
+	}
+
+	free(buff);
+	return NULL;
+}
+
+/*
+ * read with a buffer of pkt_size bytes in the mode of the run; the wait
+ * condition only looks at the byte count, segments are read under the lock
+ */
+static void * consumer(void * arg) {
+	bench_thread * bt = arg;
+	bench_queue * bq = bt -> bq;
+	pktq_read_info info;
+	shim_iter to;
+	unsigned long start;
+	ssize_t ret;
+	byte * buff;
+
+	buff = malloc(bq -> pkt_size);
+
+	while (!READ_ONCE(bq -> stop)) {
+		start = now_ns();
+		shim_mutex_lock(&(bq -> head_lock));
+		while (!pktq_has_data(&(bq -> queue)) && !READ_ONCE(bq -> stop)) {
+			shim_mutex_unlock(&(bq -> head_lock));
+			shim_wait_event(&(bq -> read_queue), pktq_queued(&(bq -> queue)) != 0 || READ_ONCE(bq -> stop));
+			shim_mutex_lock(&(bq -> head_lock));
+		}
+		if (READ_ONCE(bq -> stop)) {
+			shim_mutex_unlock(&(bq -> head_lock));
+			break;
+		}
+
+		memset(&info, 0, sizeof(info));
+		shim_iter_init(&to, buff, bq -> pkt_size);
+		if (bq -> mode == PACKET)
+			ret = pktq_read_packet(&(bq -> queue), &to, bq -> pkt_size, &info);
+		else
+			ret = pktq_read_stream(&(bq -> queue), &to, bq -> pkt_size, &info);
+		shim_mutex_unlock(&(bq -> head_lock));
+		shim_wake_up(&(bq -> write_queue));
+
+		hist_record(&(bt -> hist), now_ns() - start);
+		bt -> pkts += info.pkts;
+		bt -> bytes += ret > 0 ? ret : 0;
+	}
+
+	free(buff);
+	return NULL;
+}
+
+
+
+/*
+ * Benchmark runs
+ */
+
+/*
+ * run threads producers and as many consumers for run_ms milliseconds
+ */
+static int run(size_t pkt_size, device_mode mode, int threads, unsigned int run_ms) {
+	static bench_thread producers[MAX_THREADS];
+	static bench_thread consumers[MAX_THREADS];
+	histogram enq;
+	histogram deq;
+	bench_queue bq;
+	unsigned long start;
+	unsigned long elapsed;
+	unsigned long pkts;
+	unsigned long bytes;
+	int i;
+
+	memset(&bq, 0, sizeof(bq));
+	if (pktq_init(&(bq.queue)) != 0) return -1;
+	shim_mutex_init(&(bq.head_lock));
+	shim_mutex_init(&(bq.tail_lock));
+	shim_waitq_init(&(bq.read_queue));
+	shim_waitq_init(&(bq.write_queue));
+	bq.file_size = FILE_DEFAULT_SIZE;
+	bq.pkt_size = pkt_size;
+	bq.mode = mode;
+
+	memset(producers, 0, sizeof(producers));
+	memset(consumers, 0, sizeof(consumers));
+	start = now_ns();
+	for (i = 0; i < threads; i++) {
+		producers[i].bq = &bq;
+		consumers[i].bq = &bq;
+		pthread_create(&(producers[i].thread), NULL, producer, &producers[i]);
+		pthread_create(&(consumers[i].thread), NULL, consumer, &consumers[i]);
+	}
+
+	usleep(run_ms * 1000);
+	WRITE_ONCE(bq.stop, 1);
+	shim_wake_up_all(&(bq.read_queue));
+	shim_wake_up_all(&(bq.write_queue));
+
+	memset(&enq, 0, sizeof(enq));
+	memset(&deq, 0, sizeof(deq));
+	pkts = 0;
+	bytes = 0;
+	for (i = 0; i < threads; i++) {
+		pthread_join(producers[i].thread, NULL);
+		pthread_join(consumers[i].thread, NULL);
+		hist_merge(&enq, &(producers[i].hist));
+		hist_merge(&deq, &(consumers[i].hist));
+		pkts += consumers[i].pkts;
+		bytes += consumers[i].bytes;
+	}
+	elapsed = now_ns() - start;
+	pktq_free(&(bq.queue));
+
+	printf("%5zu %-6s %3d %12.0f %9.1f %8lu %8lu %8lu %8lu %8lu %8lu\n",
+		pkt_size, mode == PACKET ? "packet" : "stream", threads,
+		pkts * 1e9 / elapsed, bytes * 1e3 / elapsed,
+		hist_percentile(&enq, 0.5), hist_percentile(&enq, 0.99), hist_percentile(&enq, 0.999),
+		hist_percentile(&deq, 0.5), hist_percentile(&deq, 0.99), hist_percentile(&deq, 0.999));
+	return 0;
+}
+
+/*
+ * usage: pktstream_bench [milliseconds per run]
+ */
+int main(int argc, char ** argv) {
+	unsigned int run_ms;
+	unsigned int size;
+	unsigned int threads;
+	int mode;
+
+	run_ms = argc > 1 ? atoi(argv[1]) : DEFAULT_RUN_MS;
+	if (run_ms == 0) {
+		fprintf(stderr, "usage: %s [milliseconds per run]\n", argv[0]);
+		return 1;
+	}
+
+	if (create_segment_caches() != 0) {
+		fprintf(stderr, "could not create segment caches\n");
+		return 1;
+	}
+
+	printf("%5s %-6s %3s %12s %9s %8s %8s %8s %8s %8s %8s\n", "size", "mode", "thr", "msgs/s", "MB/s",
+		"enq p50", "p99", "p99.9", "deq p50", "p99", "p99.9");
+	for (size = 0; size < sizeof(pkt_sizes) / sizeof(pkt_sizes[0]); size++)
+		for (mode = PACKET; mode <= STREAM; mode++)
+			for (threads = 0; threads < sizeof(thread_counts) / sizeof(thread_counts[0]); threads++)
+				if (run(pkt_sizes[size], mode, thread_counts[threads], run_ms) != 0) {
+					fprintf(stderr, "could not initialize queue\n");
+					destroy_segment_caches();
+					return 1;
+				}
+
+	printf("latencies in ns, waits included\n");
+	destroy_segment_caches();
+	return 0;
+}
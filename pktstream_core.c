@@ -0,0 +1,488 @@
+#include "pktstream_core.h"
+
+/*
+ * Segment queue core.
+ * Michael-Scott style queues of segments starting with a dummy segment,
+ * one for each priority lane: readers move the head past consumed
+ * segments, writers link prepared chains at the tail, and the two sides
+ * only meet on the dummy segment and the byte counts. Readers always serve
+ * the highest lane holding data. Builds in the module and in user space through
+ * pktstream_shim.h.
+ */
+
+
+
+/*
+ * Global variables for the core
+ */
+
+// caches for segments, one for each payload size class
+static shim_cache * segment_caches[SEGMENT_CLASSES] = {NULL};
+
+// names of the segment caches
+static const char * segment_cache_names[SEGMENT_CLASSES] = {
+	"pktstrm_seg_64",
+	"pktstrm_seg_128",
+	"pktstrm_seg_256",
+	"pktstrm_seg_512",
+	"pktstrm_seg_1024",
+	"pktstrm_seg_2048",
+	"pktstrm_seg_4096"
+};
+
+
+
+/*
+ * Segment allocation
+ */
+
+/*
+ * create one cache for each segment size class
+ * each object holds the segment header followed by its payload
+ */
+int create_segment_caches(void) {
+	int i;
+
+	for (i = 0; i < SEGMENT_CLASSES; i++) {
+		segment_caches[i] = shim_cache_create(segment_cache_names[i], sizeof(segment) + (SEGMENT_MIN_SIZE << i));
+		if (!segment_caches[i]) {
+			destroy_segment_caches();
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/*
+ * destroy the segment caches, every segment must already be freed
+ */
+void destroy_segment_caches(void) {
+	int i;
+
+	for (i = 0; i < SEGMENT_CLASSES; i++) {
+		if (segment_caches[i] == NULL) continue;
+		shim_cache_destroy(segment_caches[i]);
+		segment_caches[i] = NULL;
+	}
+}
+
+/*
+ * smallest size class fitting cur_size, SEGMENT_LARGE if none does
+ */
+unsigned int segment_class(size_t cur_size) {
+	unsigned int size_class;
+
+	size_class = 0;
+	while (size_class < SEGMENT_CLASSES && (SEGMENT_MIN_SIZE << size_class) < cur_size) size_class++;
+	return size_class;
+}
+
+/*
+ * allocate a segment from the smallest size class fitting cur_size, or
+ * one of exactly cur_size bytes beyond the largest class, preferably on
+ * node; the payload is left uninitialized
+ */
+segment * alloc_segment(size_t cur_size, int node) {
+	segment * current_segment;
+	unsigned int size_class;
+
+	size_class = segment_class(cur_size);
+	if (size_class == SEGMENT_LARGE) {
+		if (cur_size > MAX_PKT_SIZE) return NULL;
+		current_segment = shim_large_alloc(sizeof(segment) + cur_size, node);
+	} else {
+		current_segment = shim_cache_alloc(segment_caches[size_class], node);
+	}
+	if (!current_segment) return NULL;
+
+	current_segment -> segment_size = cur_size;
+	current_segment -> segment_offset = 0;
+	current_segment -> next = NULL;
+	current_segment -> size_class = size_class;
+	current_segment -> node = node != NUMA_NO_NODE ? node : shim_node_id();
+	return current_segment;
+}
+
+/*
+ * return a segment to the cache it was taken from
+ */
+void free_segment(segment * current_segment) {
+	if (current_segment -> size_class == SEGMENT_LARGE)
+		shim_large_free(current_segment);
+	else
+		shim_cache_free(segment_caches[current_segment -> size_class], current_segment);
+}
+
+/*
+ * free a chain of segments not linked to any queue
+ */
+void free_segment_chain(segment * current_segment) {
+	segment * next;
+
+	while (current_segment != NULL) {
+		next = current_segment -> next;
+		free_segment(current_segment);
+		current_segment = next;
+	}
+}
+
+
+
+/*
+ * Queue operations
+ */
+
+/*
+ * initialize an empty queue, each lane starting with a dummy segment
+ * shared by its head and tail
+ */
+int pktq_init(pkt_queue * queue) {
+	pkt_lane * current_lane;
+	unsigned int lane;
+
+	queue -> node = NUMA_NO_NODE;
+	atomic_long_set(&(queue -> data_count), 0);
+	for (lane = 0; lane < PKTSTRM_LANES; lane++)
+		queue -> lanes[lane].first_segment = NULL;
+
+	for (lane = 0; lane < PKTSTRM_LANES; lane++) {
+		current_lane = &(queue -> lanes[lane]);
+		current_lane -> first_segment = alloc_segment(0, NUMA_NO_NODE);
+		if (!current_lane -> first_segment) {
+			pktq_free(queue);
+			return -ENOMEM;
+		}
+
+		current_lane -> first_segment -> seq = 0;
+		current_lane -> last_segment = current_lane -> first_segment;
+		current_lane -> last_seq = 0;
+		current_lane -> first_seq = 0;
+		atomic_long_set(&(current_lane -> data_count), 0);
+	}
+	return 0;
+}
+
+/*
+ * free every segment of the queue, dummy segments included
+ */
+void pktq_free(pkt_queue * queue) {
+	pkt_lane * current_lane;
+	unsigned int lane;
+
+	for (lane = 0; lane < PKTSTRM_LANES; lane++) {
+		current_lane = &(queue -> lanes[lane]);
+		free_segment_chain(current_lane -> first_segment);
+		current_lane -> first_segment = NULL;
+		current_lane -> last_segment = NULL;
+		atomic_long_set(&(current_lane -> data_count), 0);
+	}
+	atomic_long_set(&(queue -> data_count), 0);
+}
+
+/*
+ * create the chain of segments holding count bytes of client data,
+ * split in packets of pkt_size bytes
+ * no lock is needed since the chain is still private to the writer
+ */
+int pktq_create_segments(pkt_queue * queue, size_t pkt_size, size_t count, shim_iter * from, segment ** first, segment ** last) {
+	segment * current_segment;
+	size_t cur_size;
+	size_t offset;
+
+	*first = NULL;
+	*last = NULL;
+
+	for (offset = 0; offset < count; offset += cur_size) {
+		cur_size = min(count - offset, pkt_size);
+
+		// take new segment with inline buffer of specified size
+		current_segment = pktq_take_segment(queue, cur_size);
+		if (!current_segment) {
+			pktq_release_chain(queue, *first);
+			return -ENOMEM;
+		}
+
+		// the object is not zeroed, never queue it partially filled
+		if (shim_copy_from(current_segment -> segment_buffer, cur_size, from) != cur_size) {
+			pktq_release_segment(queue, current_segment);
+			pktq_release_chain(queue, *first);
+			return -EFAULT;
+		}
+
+		if (*last == NULL)
+			*first = current_segment;
+		else
+			(*last) -> next = current_segment;
+		*last = current_segment;
+	}
+
+	return 0;
+}
+
+/*
+ * give back a chain of segments not linked to the queue
+ */
+void pktq_release_chain(pkt_queue * queue, segment * current_segment) {
+	segment * next;
+
+	while (current_segment != NULL) {
+		next = current_segment -> next;
+		pktq_release_segment(queue, current_segment);
+		current_segment = next;
+	}
+}
+
+/*
+ * splice a prepared chain of segments at the end of a lane of the queue
+ * must be called holding the tail side
+ */
+size_t pktq_append(pkt_queue * queue, unsigned int lane, segment * first, segment * last, size_t count) {
+	pkt_lane * current_lane;
+	segment * current_segment;
+	unsigned long seq;
+
+	// number the segments after the current tail
+	current_lane = &(queue -> lanes[lane]);
+	seq = current_lane -> last_segment -> seq;
+	for (current_segment = first; current_segment != NULL; current_segment = current_segment -> next)
+		current_segment -> seq = ++seq;
+
+	// reserve the space, then publish the segments to readers
+	atomic_long_add(count, &(current_lane -> data_count));
+	atomic_long_add(count, &(queue -> data_count));
+	smp_store_release(&(current_lane -> last_segment -> next), first);
+	current_lane -> last_segment = last;
+	smp_store_release(&(current_lane -> last_seq), seq);
+	return count;
+}
+
+/*
+ * highest lane holding published data, PKTSTRM_LANES if none does
+ * pairs with the release stores of writers publishing new data
+ * must be called holding the head side, the dummy segments are freed as
+ * readers move past them
+ */
+unsigned int pktq_top_lane(pkt_queue * queue) {
+	unsigned int lane;
+
+	for (lane = PKTSTRM_LANES; lane > 0; lane--)
+		if (smp_load_acquire(&(queue -> lanes[lane - 1].first_segment -> next)) != NULL)
+			return lane - 1;
+	return PKTSTRM_LANES;
+}
+
+/*
+ * make a segment the new dummy of its lane, once read or dropped
+ * must be called holding the head side
+ */
+void pktq_advance(pkt_lane * current_lane, segment * current_segment) {
+	current_lane -> first_segment = current_segment;
+	smp_store_release(&(current_lane -> first_seq), current_segment -> seq);
+}
+
+/*
+ * pop the first segment of the highest lane as a single packet, bytes not
+ * fitting in the buffer are discarded
+ * must be called holding the head side, with data available
+ */
+ssize_t pktq_read_packet(pkt_queue * queue, shim_iter * to, size_t count, pktq_read_info * info) {
+	pkt_lane * current_lane;
+	segment * dummy_segment;
+	segment * current_segment;
+	size_t to_read;
+	int node;
+
+	// the read segment becomes the new dummy of its lane
+	current_lane = &(queue -> lanes[pktq_top_lane(queue)]);
+	dummy_segment = current_lane -> first_segment;
+	current_segment = smp_load_acquire(&(dummy_segment -> next));
+	to_read = min(count, current_segment -> segment_size);
+	if (shim_copy_to(current_segment -> segment_buffer + current_segment -> segment_offset, to_read, to) != to_read)
+		return -EFAULT;
+
+	node = shim_node_id();
+	if (current_segment -> node != node)
+		info -> remote += to_read;
+
+	pktq_advance(current_lane, current_segment);
+	pktq_release_segment(queue, dummy_segment);
+	pktq_release_bytes(queue, current_lane, current_segment -> segment_size);
+	info -> pkts++;
+	info -> dropped += current_segment -> segment_size - to_read;
+	return to_read;
+}
+
+/*
+ * read packets until count bytes are read or the queue is empty, always
+ * from the highest lane holding data; the residual of a packet not fitting
+ * stays queued as an independent segment
+ * must be called holding the head side
+ */
+ssize_t pktq_read_stream(pkt_queue * queue, shim_iter * to, size_t count, pktq_read_info * info) {
+	pkt_lane * current_lane;
+	segment * dummy_segment;
+	segment * current_segment;
+	size_t to_read;
+	size_t remaining_bytes;
+	ssize_t already_read;
+	unsigned int lane;
+	int node;
+
+	// already_read keeps the current amount of bytes read
+	already_read = 0;
+	node = shim_node_id();
+
+	while (already_read < count) {
+
+		/* the first segment of a lane is a dummy, data starts at the one
+		 * following it; a fully read segment becomes the new dummy, so
+		 * readers never touch the segment writers are appending to. The
+		 * lane is chosen again for every segment, so data of a higher lane
+		 * arriving meanwhile is served first
+		 */
+		lane = pktq_top_lane(queue);
+		if (lane == PKTSTRM_LANES)
+			break;
+		current_lane = &(queue -> lanes[lane]);
+		dummy_segment = current_lane -> first_segment;
+		current_segment = smp_load_acquire(&(dummy_segment -> next));
+
+		/* if the size of data contained in this segment plus what has already
+		 * been read fit in the receiving buffer, read it
+		 *
+		 * else compute the size that can fit in receiving buffer and update
+		 * current first segment with the new remaining data
+		 */
+		if ((already_read + current_segment -> segment_size) <= count){
+			to_read = current_segment -> segment_size;
+			if (shim_copy_to(current_segment -> segment_buffer + current_segment -> segment_offset, to_read, to) != to_read)
+				break;
+			pktq_advance(current_lane, current_segment);
+			pktq_release_segment(queue, dummy_segment);
+			info -> pkts++;
+		} else {
+			remaining_bytes = (already_read + current_segment -> segment_size) - count;
+			to_read = current_segment -> segment_size - remaining_bytes;
+			if (shim_copy_to(current_segment -> segment_buffer + current_segment -> segment_offset, to_read, to) != to_read)
+				break;
+			// the residual stays in place, only the consume offset moves
+			current_segment -> segment_offset += to_read;
+			current_segment -> segment_size = remaining_bytes;
+			info -> split = to_read;
+			info -> residual = remaining_bytes;
+		}
+
+		if (current_segment -> node != node)
+			info -> remote += to_read;
+		pktq_release_bytes(queue, current_lane, to_read);
+		already_read += to_read;
+	}
+
+	return already_read;
+}
+
+/*
+ * discard the oldest packet of the lowest lane up to max_lane holding
+ * data, without reading it; returns its size, zero if those lanes are empty
+ * must be called holding the head side
+ */
+size_t pktq_drop_packet(pkt_queue * queue, unsigned int max_lane) {
+	pkt_lane * current_lane;
+	segment * dummy_segment;
+	segment * current_segment;
+	size_t dropped;
+	unsigned int lane;
+
+	for (lane = 0; lane <= max_lane; lane++) {
+		current_lane = &(queue -> lanes[lane]);
+		dummy_segment = current_lane -> first_segment;
+		current_segment = smp_load_acquire(&(dummy_segment -> next));
+		if (current_segment == NULL)
+			continue;
+
+		dropped = current_segment -> segment_size;
+		pktq_advance(current_lane, current_segment);
+		pktq_release_segment(queue, dummy_segment);
+		pktq_release_bytes(queue, current_lane, dropped);
+		return dropped;
+	}
+	return 0;
+}
+
+/*
+ * check if published data is available to readers in any lane; reads no
+ * segment, so it can be used without holding the head side
+ */
+int pktq_has_data(pkt_queue * queue) {
+	unsigned int lane;
+
+	for (lane = 0; lane < PKTSTRM_LANES; lane++)
+		if (smp_load_acquire(&(queue -> lanes[lane].last_seq)) != READ_ONCE(queue -> lanes[lane].first_seq))
+			return 1;
+	return 0;
+}
+
+/*
+ * amount of bytes currently queued or reserved by writers, in all lanes
+ * or in a single one
+ */
+size_t pktq_queued(pkt_queue * queue) {
+	return atomic_long_read(&(queue -> data_count));
+}
+
+size_t pktq_lane_queued(pkt_queue * queue, unsigned int lane) {
+	return atomic_long_read(&(queue -> lanes[lane].data_count));
+}
+
+/*
+ * size of the packet read next, at the head of the highest lane
+ * must be called holding the head side, with data available
+ */
+size_t pktq_next_packet_size(pkt_queue * queue) {
+	return smp_load_acquire(&(queue -> lanes[pktq_top_lane(queue)].first_segment -> next)) -> segment_size;
+}
+
+/*
+ * give back to writers the space of count consumed bytes of a lane
+ * the consumed data must not be accessed anymore
+ */
+void pktq_release_bytes(pkt_queue * queue, pkt_lane * current_lane, size_t count) {
+	smp_mb__before_atomic();
+	atomic_long_sub(count, &(current_lane -> data_count));
+	atomic_long_sub(count, &(queue -> data_count));
+}
+
+
+
+/*
+ * Size checks
+ */
+
+/*
+ * a packet size can be set between one byte and MAX_PKT_SIZE
+ */
+int pktq_valid_pkt_size(size_t pkt_size) {
+	return pkt_size != 0 && pkt_size <= MAX_PKT_SIZE;
+}
+
+/*
+ * a file size can be set up to MAX_FILE_SIZE, never below the queued data
+ */
+int pktq_valid_file_size(size_t file_size, size_t queued) {
+	return file_size != 0 && file_size <= MAX_FILE_SIZE && file_size >= queued;
+}
+
+/*
+ * a write of count bytes queued whole can ever complete: it must fit in
+ * the file size once the queue is drained
+ */
+int pktq_admissible(size_t count, size_t file_size) {
+	return count <= file_size;
+}
+
+/*
+ * check if count more bytes fit next to the queued data
+ */
+int pktq_has_space(size_t queued, size_t count, size_t file_size) {
+	return queued + count <= file_size;
+}
@@ -0,0 +1,159 @@
+#ifndef PKTSTREAM_CORE_H
+#define PKTSTREAM_CORE_H
+
+#include "pktstream_shim.h"
+#include "pktstream.h"
+
+/*
+ * Queue core: the segment queue shared by the module and the user space
+ * benchmark. Readers own the head of the queue and writers its tail, the
+ * caller serializes each side; the core itself takes no lock.
+ */
+
+// size class of segments larger than the largest cache
+#define SEGMENT_LARGE SEGMENT_CLASSES
+
+typedef struct segment {
+	// current segment size, not counting already consumed bytes
+	size_t segment_size;
+
+	// offset of the first unconsumed byte in the segment data
+	size_t segment_offset;
+
+	// pointer to the next segment in the linked list
+	struct segment * next;
+
+	// size class (and cache) the segment was taken from, SEGMENT_LARGE
+	// for segments allocated at their own size beyond the largest class
+	unsigned int size_class;
+
+	// memory node the segment was allocated on
+	int node;
+
+	// position of the segment in the queue, increasing from the dummy
+	// segment the queue starts with
+	unsigned long seq;
+
+	// inline segment data, allocated together with the header
+	byte segment_buffer[];
+} segment;
+
+/*
+ * a FIFO list of segments of a single priority
+ */
+typedef struct pkt_lane {
+	// current amount of data bytes maintained in segments of the lane
+	atomic_long_t data_count;
+
+	// pointer to the dummy segment preceding the first data segment,
+	// owned by readers, on its own cache line
+	segment * first_segment shim_cacheline_aligned;
+
+	// pointer to the last data segment in the lane (or the dummy
+	// segment if empty), owned by writers, on its own cache line
+	segment * last_segment shim_cacheline_aligned;
+
+	// position of the last segment appended to the lane
+	unsigned long last_seq;
+
+	// position of the dummy segment, moved by readers; compared with
+	// last_seq it tells if the lane holds data without touching segments
+	unsigned long first_seq;
+} pkt_lane;
+
+typedef struct pkt_queue {
+	// current amount of data bytes maintained in segments of all lanes,
+	// reserved by writers before their data is published
+	atomic_long_t data_count;
+
+	// memory node new segments are allocated on, NUMA_NO_NODE for the
+	// node of the writer
+	int node;
+
+	// lanes of increasing priority
+	pkt_lane lanes[PKTSTRM_LANES];
+} pkt_queue;
+
+/*
+ * what a read consumed, for the statistics of the caller
+ */
+typedef struct pktq_read_info {
+	// packets read whole, or truncated by a packet read
+	size_t pkts;
+
+	// bytes of a packet read in part by a stream read, and its residual
+	size_t split;
+	size_t residual;
+
+	// bytes of a packet not fitting in the buffer of a packet read
+	size_t dropped;
+
+	// bytes copied from segments on another node than the reader
+	size_t remote;
+} pktq_read_info;
+
+
+
+/*
+ * Function declarations
+ */
+
+int create_segment_caches(void);
+
+void destroy_segment_caches(void);
+
+unsigned int segment_class(size_t cur_size);
+
+segment * alloc_segment(size_t cur_size, int node);
+
+void free_segment(segment * current_segment);
+
+void free_segment_chain(segment * current_segment);
+
+int pktq_init(pkt_queue * queue);
+
+void pktq_free(pkt_queue * queue);
+
+int pktq_create_segments(pkt_queue * queue, size_t pkt_size, size_t count, shim_iter * from, segment ** first, segment ** last);
+
+void pktq_release_chain(pkt_queue * queue, segment * current_segment);
+
+size_t pktq_append(pkt_queue * queue, unsigned int lane, segment * first, segment * last, size_t count);
+
+unsigned int pktq_top_lane(pkt_queue * queue);
+
+void pktq_advance(pkt_lane * current_lane, segment * current_segment);
+
+ssize_t pktq_read_packet(pkt_queue * queue, shim_iter * to, size_t count, pktq_read_info * info);
+
+ssize_t pktq_read_stream(pkt_queue * queue, shim_iter * to, size_t count, pktq_read_info * info);
+
+size_t pktq_drop_packet(pkt_queue * queue, unsigned int max_lane);
+
+int pktq_has_data(pkt_queue * queue);
+
+size_t pktq_queued(pkt_queue * queue);
+
+size_t pktq_lane_queued(pkt_queue * queue, unsigned int lane);
+
+size_t pktq_next_packet_size(pkt_queue * queue);
+
+void pktq_release_bytes(pkt_queue * queue, pkt_lane * current_lane, size_t count);
+
+int pktq_valid_pkt_size(size_t pkt_size);
+
+int pktq_valid_file_size(size_t file_size, size_t queued);
+
+int pktq_admissible(size_t count, size_t file_size);
+
+int pktq_has_space(size_t queued, size_t count, size_t file_size);
+
+/*
+ * provided by the user of the core: segments of a queue are taken and given
+ * back through these, so that the module can keep per minor pools
+ */
+segment * pktq_take_segment(pkt_queue * queue, size_t cur_size);
+
+void pktq_release_segment(pkt_queue * queue, segment * current_segment);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include "pktstream_lib.h"
 
 /** 
@@ -48,3 +49,357 @@ int set_packet_size(int fd, unsigned long size){
 	return -1;
 }
 
+
+
+/**
+ * set the low watermarks of blocked clients
+ * - read: bytes queued before a blocked reader is woken
+ * - write: bytes free before a blocked writer is woken
+ * */
+int set_read_lowat(int fd, unsigned long size){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_READ_LOWAT, size) == 0)
+		return 0;
+	printf("illegal specified watermark %zd", size);
+	return -1;
+}
+
+int set_write_lowat(int fd, unsigned long size){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_WRITE_LOWAT, size) == 0)
+		return 0;
+	printf("illegal specified watermark %zd", size);
+	return -1;
+}
+
+
+
+/**
+ * largest write queued whole or not at all, larger writes may be queued
+ * in parts, like writes to a pipe above PIPE_BUF
+ * */
+int set_atomic_size(int fd, unsigned long size){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_ATOMIC_SIZE, size) == 0)
+		return 0;
+	printf("illegal specified atomic size %zd", size);
+	return -1;
+}
+
+
+
+/**
+ * reserve segments for the whole file size, so that writes do not allocate
+ * while the pool holds segments; enabling it again refills a drained pool
+ * */
+int set_prealloc(int fd, int enabled){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_PREALLOC, enabled) == 0)
+		return 0;
+	printf("could not preallocate file");
+	return -1;
+}
+
+
+
+/**
+ * allocate the segments of the file on a memory node, or on the node of its
+ * reader with PKTSTRM_NUMA_FOLLOW
+ * */
+int set_numa_node(int fd, int node){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_NUMA_NODE, node) == 0)
+		return 0;
+	printf("illegal specified memory node %d", node);
+	return -1;
+}
+
+
+
+/**
+ * choose what writers do when the file is full
+ * - OVERFLOW_BLOCK: sleep until space is freed, unless non-blocking
+ * - OVERFLOW_FAIL: fail with ENOBUFS
+ * - OVERFLOW_DROP_OLDEST: evict the oldest packets to make room
+ * */
+int set_overflow(int fd, overflow_policy policy){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_OVERFLOW, policy) == 0)
+		return 0;
+	printf("illegal specified overflow policy %d", policy);
+	return -1;
+}
+
+/**
+ * collect the packets and bytes evicted since the last call
+ * */
+int get_drops(int fd, pktstrm_drops * drops){
+	if(ioctl(fd, PKTSTRM_IOCTL_GET_DROPS, drops) == 0)
+		return 0;
+	printf("could not get dropped packets");
+	return -1;
+}
+
+
+
+/**
+ * write to a priority lane, reads serve the highest lane holding data
+ * */
+int set_lane(int fd, unsigned int lane){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_LANE, lane) == 0)
+		return 0;
+	printf("illegal specified lane %u", lane);
+	return -1;
+}
+
+/**
+ * keep bytes of the file size for the data of a lane
+ * */
+int set_lane_reserve(int fd, unsigned int lane, size_t bytes){
+	pktstrm_lane_reserve reserve;
+
+	reserve.lane = lane;
+	reserve.bytes = bytes;
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_LANE_RESERVE, &reserve) == 0)
+		return 0;
+	printf("illegal specified reservation %zd", bytes);
+	return -1;
+}
+
+
+
+/**
+ * deliver every packet to every reading session of the file
+ * */
+int set_broadcast(int fd, int enabled){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_BROADCAST, enabled) == 0)
+		return 0;
+	printf("could not change broadcast mode");
+	return -1;
+}
+
+
+
+/**
+ * read up to max_pkts packets with a single call, stored back to back in buff
+ * returns the number of packets read, their lengths are stored in lengths
+ * */
+int read_batch(int fd, char *buff, size_t size, unsigned int *lengths, unsigned int max_pkts){
+	pktstrm_batch batch;
+
+	batch.buff = buff;
+	batch.size = size;
+	batch.lengths = lengths;
+	batch.max_pkts = max_pkts;
+	return ioctl(fd, PKTSTRM_IOCTL_READ_BATCH, &batch);
+}
+
+
+
+
+/**
+ * select the storage engine, only allowed while the file is empty
+ * - list: linked list of segments
+ * - ring: contiguous byte ring with packet boundary index
+ * */
+int set_engine_list(int fd){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_ENGINE_LIST) == 0)
+		return 0;
+	printf("cannot switch to list engine");
+	return -1;
+}
+
+int set_engine_ring(int fd){
+	if(ioctl(fd, PKTSTRM_IOCTL_SET_ENGINE_RING) == 0)
+		return 0;
+	printf("cannot switch to ring engine");
+	return -1;
+}
+
+
+
+/**
+ * declare the minor as single producer single consumer
+ * while at most one session reads and one writes, read and write operations
+ * take no lock; sessions must not share their descriptor across threads
+ * */
+void set_spsc(int fd, int enabled){
+	ioctl(fd, PKTSTRM_IOCTL_SET_SPSC, enabled);
+}
+
+
+
+/**
+ * map the ring engine storage of a minor, to produce and consume in place
+ * the bytes are mapped twice back to back, so that any packet is contiguous
+ * even when it wraps around the end of the ring
+ * the mapping client acts as the single producer or consumer of the minor
+ * */
+int map_ring(int fd, ring_map *map){
+	pktstrm_ring_ctrl *ctrl;
+	size_t page_size;
+	size_t data_offset;
+	size_t data_size;
+	byte *base;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	ctrl = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ctrl == MAP_FAILED) {
+		printf("cannot map ring control page");
+		return -1;
+	}
+	data_offset = ctrl->data_offset;
+	data_size = ctrl->data_size;
+	munmap(ctrl, page_size);
+
+	base = mmap(NULL, data_offset + 2 * data_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		printf("cannot reserve ring address range");
+		return -1;
+	}
+	if (mmap(base, data_offset + data_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+			mmap(base + data_offset + data_size, data_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, data_offset) == MAP_FAILED) {
+		munmap(base, data_offset + 2 * data_size);
+		printf("cannot map ring storage");
+		return -1;
+	}
+
+	map->fd = fd;
+	map->ctrl = (pktstrm_ring_ctrl *) base;
+	map->lengths = (unsigned int *) (base + map->ctrl->lengths_offset);
+	map->data = base + data_offset;
+	map->map_size = data_offset + 2 * data_size;
+	return 0;
+}
+
+void unmap_ring(ring_map *map){
+	munmap(map->ctrl, map->map_size);
+}
+
+/**
+ * produce a packet in place
+ * - begin: pointer to size free bytes, NULL if the ring is full
+ * - commit: publish the packet, waking sleeping readers if any
+ * */
+byte *ring_write_begin(ring_map *map, unsigned int size){
+	pktstrm_ring_ctrl *ctrl = map->ctrl;
+	unsigned int tail;
+	unsigned int pkt_tail;
+
+	tail = __atomic_load_n(&ctrl->tail, __ATOMIC_ACQUIRE);
+	pkt_tail = __atomic_load_n(&ctrl->pkt_tail, __ATOMIC_ACQUIRE);
+	if (ctrl->head - tail + size > ctrl->capacity || ctrl->pkt_head - pkt_tail >= ctrl->pkt_slots)
+		return NULL;
+	return map->data + (ctrl->head & (ctrl->data_size - 1));
+}
+
+void ring_write_commit(ring_map *map, unsigned int size){
+	pktstrm_ring_ctrl *ctrl = map->ctrl;
+
+	map->lengths[ctrl->pkt_head & (ctrl->pkt_slots - 1)] = size;
+	__atomic_store_n(&ctrl->pkt_head, ctrl->pkt_head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ctrl->head, ctrl->head + size, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ctrl->read_waiters, __ATOMIC_RELAXED) != 0)
+		ioctl(map->fd, PKTSTRM_IOCTL_RING_NOTIFY);
+}
+
+/**
+ * consume a packet in place
+ * - begin: pointer to the next packet and its size, NULL if the ring is empty
+ * - commit: release the packet, waking sleeping writers if any
+ * */
+byte *ring_read_begin(ring_map *map, unsigned int *size){
+	pktstrm_ring_ctrl *ctrl = map->ctrl;
+
+	if (__atomic_load_n(&ctrl->pkt_head, __ATOMIC_ACQUIRE) == ctrl->pkt_tail)
+		return NULL;
+	*size = map->lengths[ctrl->pkt_tail & (ctrl->pkt_slots - 1)];
+	return map->data + (ctrl->tail & (ctrl->data_size - 1));
+}
+
+void ring_read_commit(ring_map *map){
+	pktstrm_ring_ctrl *ctrl = map->ctrl;
+	unsigned int size;
+
+	size = map->lengths[ctrl->pkt_tail & (ctrl->pkt_slots - 1)];
+	__atomic_store_n(&ctrl->tail, ctrl->tail + size, __ATOMIC_RELEASE);
+	__atomic_store_n(&ctrl->pkt_tail, ctrl->pkt_tail + 1, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ctrl->write_waiters, __ATOMIC_RELAXED) != 0)
+		ioctl(map->fd, PKTSTRM_IOCTL_RING_NOTIFY);
+}
+
+/** sleep in the device until data or space for size bytes is available */
+int ring_wait_data(ring_map *map){
+	return ioctl(map->fd, PKTSTRM_IOCTL_RING_WAIT_DATA);
+}
+
+int ring_wait_space(ring_map *map, unsigned int size){
+	return ioctl(map->fd, PKTSTRM_IOCTL_RING_WAIT_SPACE, (unsigned long) size);
+}
+
+
+
+/**
+ * latency histograms, with HIST_SUB_BUCKETS linear buckets for each power
+ * of two so that the relative error stays bounded whatever the range
+ * - percentile: lower bound of the bucket holding the given fraction
+ * */
+void hist_record(histogram *hist, unsigned long value){
+	int msb;
+	unsigned int bucket;
+
+	if (value < HIST_SUB_BUCKETS) {
+		bucket = value;
+	} else {
+		msb = 63 - __builtin_clzl(value);
+		bucket = (msb - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + ((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+	}
+	hist->counts[bucket]++;
+	hist->total++;
+	hist->sum += value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+void hist_merge(histogram *dst, histogram *src){
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->total += src->total;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+unsigned long hist_percentile(histogram *hist, double fraction){
+	unsigned long seen;
+	unsigned long target;
+	unsigned int bucket;
+
+	if (hist->total == 0)
+		return 0;
+	target = (unsigned long) (fraction * hist->total);
+	if (target == 0)
+		target = 1;
+
+	seen = 0;
+	for (bucket = 0; bucket < HIST_BUCKETS - 1; bucket++) {
+		seen += hist->counts[bucket];
+		if (seen >= target)
+			break;
+	}
+	if (bucket < HIST_SUB_BUCKETS)
+		return bucket;
+	return (unsigned long) (HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS) << (bucket / HIST_SUB_BUCKETS - 1);
+}
+
+/** print the percentile distribution of a histogram, in the HdrHistogram layout */
+void hist_print(histogram *hist, const char *unit){
+	static const double fractions[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999};
+	unsigned int i;
+
+	printf("%12s %12s %12s\n", unit, "percentile", "count");
+	for (i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++)
+		printf("%12lu %12.6f %12lu\n", hist_percentile(hist, fractions[i]), fractions[i], (unsigned long) (fractions[i] * hist->total));
+	printf("%12lu %12.6f %12lu\n", hist->max, 1.0, hist->total);
+	printf("#[mean = %.1f, max = %lu, total count = %lu]\n", hist->total ? (double) hist->sum / hist->total : 0.0, hist->max, hist->total);
+}
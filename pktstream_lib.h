@@ -1,6 +1,7 @@
 #ifndef PKTSTREAM_LIB_H
 #define PKTSTREAM_LIB_H
 
+#include <stddef.h>
 #include "pktstream.h"
 
 void set_mode_packet(int);
@@ -12,5 +13,62 @@ void set_access_non_blocking(int);
 int set_file_size(int, unsigned long);
 int set_packet_size(int, unsigned long);
 
+int set_read_lowat(int, unsigned long);
+int set_write_lowat(int, unsigned long);
+
+int set_atomic_size(int, unsigned long);
+
+int set_prealloc(int, int);
+int set_numa_node(int, int);
+
+int set_overflow(int, overflow_policy);
+int get_drops(int, pktstrm_drops *);
+
+int set_lane(int, unsigned int);
+int set_lane_reserve(int, unsigned int, size_t);
+int set_broadcast(int, int);
+
+int read_batch(int, char *, size_t, unsigned int *, unsigned int);
+
+int set_engine_list(int);
+int set_engine_ring(int);
+
+void set_spsc(int, int);
+
+typedef struct ring_map {
+	int fd;
+	pktstrm_ring_ctrl * ctrl;
+	unsigned int * lengths;
+	byte * data;
+	size_t map_size;
+} ring_map;
+
+int map_ring(int, ring_map *);
+void unmap_ring(ring_map *);
+
+byte * ring_write_begin(ring_map *, unsigned int);
+void ring_write_commit(ring_map *, unsigned int);
+byte * ring_read_begin(ring_map *, unsigned int *);
+void ring_read_commit(ring_map *);
+
+int ring_wait_data(ring_map *);
+int ring_wait_space(ring_map *, unsigned int);
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_BUCKETS)
+
+typedef struct histogram {
+	unsigned long counts[HIST_BUCKETS];
+	unsigned long total;
+	unsigned long sum;
+	unsigned long max;
+} histogram;
+
+void hist_record(histogram *, unsigned long);
+void hist_merge(histogram *, histogram *);
+unsigned long hist_percentile(histogram *, double);
+void hist_print(histogram *, const char *);
+
 
 #endif
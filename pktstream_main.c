@@ -0,0 +1,3031 @@
+#define EXPORT_SYMTAB
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/pid.h>
+#include <linux/tty.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/percpu-rwsem.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/kref.h>
+#include <linux/rcupdate.h>
+#include <linux/shrinker.h>
+#include <linux/xarray.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <asm/mutex.h>
+#include <asm/uaccess.h>
+#include "pktstream.h"
+#include "pktstream_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "pktstream_trace.h"
+
+
+
+/*
+ * Multi-mode packet stream device file.
+ * This driver provides a FIFO device file accessible as either a stream device
+ * or a packet device.
+ */
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Giorgio Severi");
+MODULE_DESCRIPTION("Multi-mode packet stream device file");
+MODULE_VERSION("0.1");
+
+
+
+/*
+ * Data structures used by the module
+ */
+
+typedef struct ring {
+	// shared control page with the ring indices, start of the storage
+	pktstrm_ring_ctrl * ctrl;
+
+	// byte storage, its size is a power of two not smaller than file size
+	byte * data;
+	size_t data_size;
+
+	// packet boundary storage, one length for each queued packet
+	unsigned int * lengths;
+	size_t pkt_slots;
+
+	// size of the whole storage, as seen by mmap
+	size_t map_size;
+
+	// the storage is freed once lockless readers left it
+	struct rcu_head rcu;
+} ring;
+
+/*
+ * runtime counters of a minor, kept per cpu and summed when read
+ */
+typedef struct minor_stats {
+	// packets and bytes written to and read from the minor
+	u64 pkts_in;
+	u64 bytes_in;
+	u64 pkts_out;
+	u64 bytes_out;
+
+	// bytes of packets not fitting in the buffer of a packet read
+	u64 bytes_dropped;
+
+	// packets read in part by stream reads
+	u64 splits;
+
+	// clients put to sleep and the total time they slept
+	u64 blocked_reads;
+	u64 blocked_writes;
+	u64 read_wait_ns;
+	u64 write_wait_ns;
+
+	// non-blocking reads and writes returning without data or space,
+	// and writes failing on a full minor
+	u64 would_block;
+
+	// packets and bytes evicted to make room for writes
+	u64 evicted_pkts;
+	u64 evicted_bytes;
+
+	// head or tail lock found held by another client
+	u64 lock_contended;
+
+	// bytes read from segments on another node than the reader
+	u64 remote_bytes;
+
+	// highest amount of queued bytes observed on this cpu
+	u64 peak_queued;
+} minor_stats;
+
+typedef struct minor_file {
+	// minor number of this file, reported by tracepoints
+	int minor;
+
+	// references held by the minor table and by each open file
+	struct kref refs;
+
+	// serializes open and release of the minor and protects the
+	// client counters
+	struct mutex open_lock;
+
+	// set once the minor has been removed from the table
+	int unlinked;
+
+	// number of clients using this minor
+	unsigned int clients;
+
+	// number of clients opened for reading and for writing
+	unsigned int readers;
+	unsigned int writers;
+
+	// single producer single consumer fast path requested via ioctl
+	int spsc_requested;
+
+	// readers and writers skip the head and tail locks, only changed
+	// holding spsc_sem for writing and both minor locks
+	int spsc;
+
+	// held for reading by lock-free readers and writers
+	struct percpu_rw_semaphore spsc_sem;
+
+	// current default segment size
+	size_t def_segment_size;
+
+	// current maximum file size
+	size_t file_size;
+
+	// writes up to this many bytes are queued whole or not at all,
+	// larger ones may be queued in parts
+	size_t atomic_size;
+
+	// bytes of the file size only the data of each lane may use
+	size_t lane_reserve[PKTSTRM_LANES];
+
+	// blocked readers are woken once this many bytes are queued,
+	// blocked writers once this many bytes are free
+	size_t read_lowat;
+	size_t write_lowat;
+
+	// lock held by readers, protects the head of the queue, and wait
+	// queue for reading access, on the cache line of readers
+	struct mutex head_lock ____cacheline_aligned_in_smp;
+	wait_queue_head_t read_queue;
+
+	// lock held by writers, protects the tail of the queue, and wait
+	// queue for writing access, on the cache line of writers
+	struct mutex tail_lock ____cacheline_aligned_in_smp;
+	wait_queue_head_t write_queue;
+
+	// queue of segments used by the list engine, its head owned by
+	// readers and its tail by writers
+	pkt_queue queue;
+
+	// storage engine used by the minor file
+	storage_engine engine;
+
+	// segments are allocated on queue.node, pinned via ioctl, or else
+	// following the node of the last reader
+	int numa_pinned;
+
+	// free segments reserved for writers, chained through next, and
+	// their number; only changed holding pool_lock
+	spinlock_t pool_lock;
+	segment * pool;
+	unsigned int pool_count;
+
+	// segments the pool holds when full, zero when not preallocating,
+	// their size class and their node, NUMA_NO_NODE for any
+	unsigned int pool_target;
+	unsigned int pool_class;
+	int pool_node;
+
+	// preallocation of the whole file size requested via ioctl
+	int prealloc;
+
+	// every reading session receives all the data, from its own cursor
+	int broadcast;
+
+	// what writers do when the minor is full, only changed holding
+	// spsc_sem for writing and both minor locks
+	overflow_policy overflow;
+
+	// packets and bytes evicted by writers, not yet reported to a reader
+	atomic_long_t drops_pkts;
+	atomic_long_t drops_bytes;
+
+	// reading sessions, protected by the head lock
+	struct list_head subscribers;
+
+	// byte and packet boundary rings used by the ring engine, NULL with
+	// the list engine; only replaced holding both locks and spsc_sem for
+	// writing, lockless readers use it under rcu_read_lock
+	ring __rcu * data_ring;
+
+	// number of user space mappings of the ring, which cannot move while
+	// mapped
+	atomic_t ring_mappings;
+
+	// tasks sleeping on the read and write queues, mirrored in the ring
+	// control page for clients producing and consuming in place
+	spinlock_t waiters_lock;
+	unsigned int read_waiters;
+	unsigned int write_waiters;
+
+	// runtime counters and the debugfs file exposing them
+	minor_stats __percpu * stats;
+	struct dentry * stats_file;
+
+	// the structure is freed after a grace period, lockless lookups
+	// may still be looking at it
+	struct rcu_head rcu;
+} minor_file;
+
+/*
+ * I/O context of an open file, its modes do not affect other sessions
+ * on the same minor
+ */
+typedef struct session {
+	// minor file the session was opened on, referenced until release
+	minor_file * current_minor;
+
+	// operational mode of the session
+	device_mode op_mode;
+
+	// access mode of the session
+	access_mode ac_mode;
+
+	// priority lane the session writes to
+	unsigned int lane;
+
+	// entry in the subscribers of the minor, for reading sessions
+	struct list_head subscriber;
+
+	// broadcast cursor: last segment consumed by the session, its
+	// position, and bytes already read of the following segment
+	segment * cursor;
+	unsigned long cursor_seq;
+	size_t cursor_offset;
+} session;
+
+// update a counter of the minor on the local cpu
+#define minor_stat_add(current_minor, field, value) this_cpu_add((current_minor) -> stats -> field, (value))
+
+
+
+/*
+ * Global variables for the module
+ */
+
+// sparse table of the initialized minors, looked up under rcu_read_lock
+// and published with xa_cmpxchg
+static DEFINE_XARRAY(minor_files);
+
+// number of minors exposed by the driver
+static unsigned int instances = 256;
+module_param(instances, uint, 0444);
+MODULE_PARM_DESC(instances, "number of device file instances (minor numbers)");
+
+// device numbers, character device and class creating the device nodes
+static dev_t pktstream_devt;
+static struct cdev pktstream_cdev;
+static struct class * pktstream_class;
+
+// storage engine of newly initialized minors
+static int default_engine = LIST;
+module_param(default_engine, int, 0644);
+MODULE_PARM_DESC(default_engine, "storage engine of new minors: 0 linked list, 1 ring");
+
+// memory node new minors are placed on and pinned to
+static int minor_node = NUMA_NO_NODE;
+module_param(minor_node, int, 0644);
+MODULE_PARM_DESC(minor_node, "memory node of new minors and their segments, -1 to follow the node of their reader");
+
+// debugfs directory holding the statistics of each minor
+static struct dentry * debugfs_dir;
+
+
+
+/*
+ * Function declarations
+ */
+
+int pktstream_open(struct inode *node, struct file *file_p);
+
+int pktstream_release(struct inode *node, struct file *file_p);
+
+ssize_t pktstream_read_iter(struct kiocb *iocb, struct iov_iter *to);
+
+ssize_t pktstream_write_iter(struct kiocb *iocb, struct iov_iter *from);
+
+ssize_t write_part(minor_file * current_minor, unsigned int lane, struct iov_iter * from, size_t want);
+
+void pktstream_exit(void);
+
+int pktstream_init(void);
+
+long pktstream_ioctl(struct file *file_p, unsigned int ioctl_cmd, unsigned long ioctl_arg);
+
+ssize_t list_read_packet(minor_file * current_minor, struct iov_iter * to, size_t count);
+
+void stat_read(minor_file * current_minor, pktq_read_info * info);
+
+void follow_reader(minor_file * current_minor);
+
+size_t next_packet_size(minor_file * current_minor);
+
+int acquire_readable(minor_file * current_minor, int minor, access_mode ac_mode, int * lock_free);
+
+long pktstream_read_batch(session * current_session, pktstrm_batch * user_batch);
+
+minor_file * retrieve_minor(struct file *file_p, char * operation);
+
+session * retrieve_session(struct file *file_p, char * operation);
+
+minor_file * alloc_minor(int minor);
+
+minor_file * get_minor(int minor);
+
+void put_minor(minor_file * current_minor);
+
+void subscribe(minor_file * current_minor, session * current_session);
+
+int subscriber_has_data(session * current_session);
+
+void broadcast_release(minor_file * current_minor);
+
+ssize_t broadcast_read(session * current_session, struct iov_iter * to, size_t count, access_mode ac_mode);
+
+long request_broadcast(minor_file * current_minor, int enabled);
+
+long request_overflow(minor_file * current_minor, unsigned long policy);
+
+size_t evict_oldest(minor_file * current_minor, unsigned int lane, size_t count);
+
+long report_drops(minor_file * current_minor, pktstrm_drops * user_drops);
+
+void print_bytes(byte * buff, unsigned int cur_size);
+
+int acquire_lock(struct mutex * lock, int minor);
+
+int lock_minor(minor_file * current_minor, int minor);
+
+void unlock_minor(minor_file * current_minor);
+
+size_t queued_bytes(minor_file * current_minor);
+
+void release_bytes(minor_file * current_minor, size_t count);
+
+int has_data(minor_file * current_minor);
+
+int above_read_lowat(minor_file * current_minor);
+
+int above_write_lowat(minor_file * current_minor);
+
+void wake_readers(minor_file * current_minor);
+
+void wake_writers(minor_file * current_minor);
+
+int acquire_side(minor_file * current_minor, struct mutex * lock, int minor, int * lock_free);
+
+void release_side(minor_file * current_minor, struct mutex * lock, int lock_free);
+
+void update_spsc(minor_file * current_minor);
+
+long request_spsc(minor_file * current_minor, int requested);
+
+void free_minor(minor_file * current_minor);
+
+void free_minor_segments(minor_file * current_minor);
+
+segment * take_segment(minor_file * current_minor, size_t cur_size);
+
+void release_segment(minor_file * current_minor, segment * current_segment);
+
+void release_segment_chain(minor_file * current_minor, segment * current_segment);
+
+segment * pool_resize(minor_file * current_minor);
+
+int pool_fill(minor_file * current_minor);
+
+int register_pool_shrinker(void);
+
+void unregister_pool_shrinker(void);
+
+int has_space(minor_file * current_minor, size_t count);
+
+int reserves_apply(minor_file * current_minor);
+
+size_t reserved_bytes(minor_file * current_minor, unsigned int lane);
+
+size_t unused_reserve(minor_file * current_minor, unsigned int lane);
+
+int lane_has_space(minor_file * current_minor, unsigned int lane, size_t count);
+
+size_t writable_bytes(minor_file * current_minor, unsigned int lane, size_t count);
+
+size_t write_unit(minor_file * current_minor, size_t count);
+
+int set_storage_engine(minor_file * current_minor, storage_engine engine);
+
+ring * ring_alloc(size_t file_size);
+
+void ring_release(ring * data_ring);
+
+void ring_release_deferred(ring * data_ring);
+
+ring * minor_ring(minor_file * current_minor);
+
+int ring_resize(minor_file * current_minor, size_t file_size);
+
+unsigned int ring_queued(ring * data_ring);
+
+void sync_ring_waiters(minor_file * current_minor);
+
+int wait_for_data(minor_file * current_minor);
+
+int wait_for_space(minor_file * current_minor, unsigned int lane, size_t count);
+
+int pktstream_mmap(struct file *file_p, struct vm_area_struct *vma);
+
+__poll_t pktstream_poll(struct file *file_p, struct poll_table_struct *wait);
+
+size_t ring_append(minor_file * current_minor, size_t count, struct iov_iter * from);
+
+ssize_t ring_read_packet(minor_file * current_minor, struct iov_iter * to, size_t count);
+
+ssize_t ring_read_stream(minor_file * current_minor, struct iov_iter * to, size_t count);
+
+size_t ring_drop_packet(minor_file * current_minor);
+
+void create_minor_stats_file(minor_file * current_minor);
+
+void stat_queued(minor_file * current_minor, size_t queued);
+
+int register_device(void);
+
+void unregister_device(void);
+
+
+
+/*
+ * Struct declaring the file access functions
+ */
+
+struct file_operations pktstream_fops = {
+	.owner = THIS_MODULE,
+	.read_iter = pktstream_read_iter,
+	.write_iter = pktstream_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
+	.splice_write = iter_file_splice_write,
+	.open = pktstream_open,
+	.release = pktstream_release,
+	.unlocked_ioctl = pktstream_ioctl,
+	.mmap = pktstream_mmap,
+	.poll = pktstream_poll
+};
+
+
+
+/*
+ * Mandatory initialization and exit functions
+ */
+
+module_init(pktstream_init);
+
+module_exit(pktstream_exit);
+
+
+
+/*
+ * Module life-cycle utilities
+ */
+
+int pktstream_init(void) {
+	int ret;
+
+	// create the segment caches before any minor can be opened
+	if (create_segment_caches() != 0) {
+		printk(KERN_ALERT "%s: cannot create segment caches\n", DEVICE_NAME);
+		return -ENOMEM;
+	}
+
+	// pools of idle minors are given back under memory pressure
+	if (register_pool_shrinker() != 0) {
+		printk(KERN_ALERT "%s: cannot register pool shrinker\n", DEVICE_NAME);
+		destroy_segment_caches();
+		return -ENOMEM;
+	}
+
+	// statistics files are added as minors are initialized
+	debugfs_dir = debugfs_create_dir(DEVICE_NAME, NULL);
+
+	// obtain the device numbers and create the device nodes
+	ret = register_device();
+	if (ret < 0) {
+		debugfs_remove_recursive(debugfs_dir);
+		unregister_pool_shrinker();
+		destroy_segment_caches();
+		return ret;
+	}
+	printk(KERN_INFO "%s: registered correctly with major number %d, %u minors\n", DEVICE_NAME, MAJOR(pktstream_devt), instances);
+
+	printk(KERN_INFO "inserting module: %s\n", DEVICE_NAME);
+
+	return 0;
+}
+
+void pktstream_exit(void){
+	minor_file * current_minor;
+	unsigned long minor;
+
+	unregister_device();
+	unregister_pool_shrinker();
+
+	// release minors still holding buffered data, then the caches;
+	// no file is open, the table holds the only references
+	xa_for_each(&minor_files, minor, current_minor) {
+		xa_erase(&minor_files, minor);
+		free_minor(current_minor);
+	}
+	xa_destroy(&minor_files);
+	debugfs_remove_recursive(debugfs_dir);
+
+	// ring storage released with a deferred free must be gone first
+	rcu_barrier();
+	destroy_segment_caches();
+
+	printk(KERN_INFO "removing module: %s\n", DEVICE_NAME);
+}
+
+/*
+ * device nodes are readable and writable by every user
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+static char * pktstream_devnode(const struct device * dev, umode_t * mode) {
+#else
+static char * pktstream_devnode(struct device * dev, umode_t * mode) {
+#endif
+	if (mode) *mode = 0666;
+	return NULL;
+}
+
+/*
+ * allocate a region of device numbers for all the instances and create
+ * their nodes as /dev/pktstrm<minor>; minors themselves are allocated on
+ * first open
+ */
+int register_device(void) {
+	struct device * node;
+	unsigned int minor;
+	int ret;
+
+	if (instances == 0 || instances > MINORMASK + 1) {
+		printk(KERN_ALERT "%s: invalid number of instances %u\n", DEVICE_NAME, instances);
+		return -EINVAL;
+	}
+
+	ret = alloc_chrdev_region(&pktstream_devt, 0, instances, DEVICE_NAME);
+	if (ret < 0) {
+		printk(KERN_ALERT "%s: cannot obtain device numbers\n", DEVICE_NAME);
+		return ret;
+	}
+
+	cdev_init(&pktstream_cdev, &pktstream_fops);
+	pktstream_cdev.owner = THIS_MODULE;
+	ret = cdev_add(&pktstream_cdev, pktstream_devt, instances);
+	if (ret < 0) {
+		printk(KERN_ALERT "%s: cannot add character device\n", DEVICE_NAME);
+		goto unregister_region;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	pktstream_class = class_create(DEVICE_NAME);
+#else
+	pktstream_class = class_create(THIS_MODULE, DEVICE_NAME);
+#endif
+	if (IS_ERR(pktstream_class)) {
+		printk(KERN_ALERT "%s: cannot create device class\n", DEVICE_NAME);
+		ret = PTR_ERR(pktstream_class);
+		goto delete_cdev;
+	}
+	pktstream_class -> devnode = pktstream_devnode;
+
+	for (minor = 0; minor < instances; minor++) {
+		node = device_create(pktstream_class, NULL, MKDEV(MAJOR(pktstream_devt), minor), NULL, DEVICE_NAME "%u", minor);
+		if (IS_ERR(node)) {
+			printk(KERN_ALERT "%s: cannot create device node for minor %u\n", DEVICE_NAME, minor);
+			ret = PTR_ERR(node);
+			goto destroy_nodes;
+		}
+	}
+	return 0;
+
+destroy_nodes:
+	while (minor-- > 0)
+		device_destroy(pktstream_class, MKDEV(MAJOR(pktstream_devt), minor));
+	class_destroy(pktstream_class);
+delete_cdev:
+	cdev_del(&pktstream_cdev);
+unregister_region:
+	unregister_chrdev_region(pktstream_devt, instances);
+	return ret;
+}
+
+void unregister_device(void) {
+	unsigned int minor;
+
+	for (minor = 0; minor < instances; minor++)
+		device_destroy(pktstream_class, MKDEV(MAJOR(pktstream_devt), minor));
+	class_destroy(pktstream_class);
+	cdev_del(&pktstream_cdev);
+	unregister_chrdev_region(pktstream_devt, instances);
+}
+
+
+
+/*
+ * Module open and release
+ */
+
+int pktstream_open(struct inode *node, struct file *file_p){
+	minor_file * current_minor;
+	session * current_session;
+
+	// retrieving minor number from file descriptor
+	int minor = iminor(file_p -> f_path.dentry -> d_inode) - MINOR(pktstream_devt);
+	pr_debug("%s: opening minor number %d\n", DEVICE_NAME, minor);
+
+	// check if minor number is valid
+	if (minor < 0 || minor >= instances) {
+		printk(KERN_ALERT "%s: warning opening an invalid minor number %d\n", DEVICE_NAME, minor);
+		return -1;
+	}
+
+	// the session starts in packet mode, blocking unless opened with O_NONBLOCK
+	current_session = kzalloc(sizeof(session), GFP_KERNEL);
+	if (!current_session) {
+		printk(KERN_ALERT "%s: could not allocate session for minor %d\n", DEVICE_NAME, minor);
+		return -1;
+	}
+	current_session -> op_mode = PACKET;
+	current_session -> ac_mode = (file_p -> f_flags & O_NONBLOCK) ? NON_BLOCK : BLOCK;
+	current_session -> lane = 0;
+
+	// take a reference on the minor, creating it if needed
+	current_minor = get_minor(minor);
+	if (!current_minor) {
+		kfree(current_session);
+		return -1;
+	}
+	current_session -> current_minor = current_minor;
+
+	// reading sessions subscribe to the minor for broadcast mode
+	if (file_p -> f_mode & FMODE_READ) {
+		mutex_lock(&(current_minor -> head_lock));
+		subscribe(current_minor, current_session);
+		mutex_unlock(&(current_minor -> head_lock));
+	}
+
+	// a second reader or writer disables the lock-free fast path
+	if (file_p -> f_mode & FMODE_READ) current_minor -> readers++;
+	if (file_p -> f_mode & FMODE_WRITE) current_minor -> writers++;
+	update_spsc(current_minor);
+	pr_debug("%s: update client count %d for minor number %d\n", DEVICE_NAME, current_minor -> clients, minor);
+	mutex_unlock(&(current_minor -> open_lock));
+
+	// the data path reaches the minor through the session, never the table
+	file_p -> private_data = current_session;
+	return 0;
+}
+
+int pktstream_release(struct inode *node, struct file *file_p){
+	minor_file * current_minor;
+	session * current_session;
+	int unlink;
+
+	current_session = retrieve_session(file_p, "release");
+	current_minor = current_session -> current_minor;
+
+	// decrease clients counter for minor file
+	mutex_lock(&(current_minor -> open_lock));
+
+	// a leaving subscriber may have been the slowest one
+	if (file_p -> f_mode & FMODE_READ) {
+		mutex_lock(&(current_minor -> head_lock));
+		list_del(&(current_session -> subscriber));
+		if (current_minor -> broadcast) broadcast_release(current_minor);
+		mutex_unlock(&(current_minor -> head_lock));
+		wake_writers(current_minor);
+	}
+
+	current_minor -> clients--;
+	if (file_p -> f_mode & FMODE_READ) current_minor -> readers--;
+	if (file_p -> f_mode & FMODE_WRITE) current_minor -> writers--;
+	pr_debug("%s: update client count %d for minor number %d\n", DEVICE_NAME, current_minor -> clients, current_minor -> minor);
+
+	/* if no clients are connected and no data is present, remove the
+	 * minor from the table; no client can be added without the open
+	 * lock, so the decision is final
+	 */
+	unlink = current_minor -> clients == 0 && queued_bytes(current_minor) == 0;
+	if (unlink) {
+		current_minor -> unlinked = 1;
+		debugfs_remove(current_minor -> stats_file);
+		current_minor -> stats_file = NULL;
+		xa_erase(&minor_files, current_minor -> minor);
+		pr_debug("%s: unlinked minor number %d\n", DEVICE_NAME, current_minor -> minor);
+	} else {
+		update_spsc(current_minor);
+	}
+	mutex_unlock(&(current_minor -> open_lock));
+
+	// drop the reference of the table, then the one of the file
+	if (unlink) put_minor(current_minor);
+	put_minor(current_minor);
+	kfree(current_session);
+	return 0;
+}
+
+/*
+ * allocate and initialize the structures of a minor, not yet published
+ */
+minor_file * alloc_minor(int minor) {
+	minor_file * current_minor;
+	int node;
+
+	// place the minor on the chosen node, or on the node of its first client
+	node = READ_ONCE(minor_node);
+	if (node < 0 || node >= nr_node_ids || !node_online(node))
+		node = NUMA_NO_NODE;
+	current_minor = kzalloc_node(sizeof(minor_file), GFP_KERNEL, node);
+	if (!current_minor) {
+		printk(KERN_ALERT "%s: could not allocate memory for current minor %d\n", DEVICE_NAME, minor);
+		return NULL;
+	}
+
+	// the queue starts with a dummy segment shared by head and tail
+	current_minor -> stats = alloc_percpu(minor_stats);
+	if (pktq_init(&(current_minor -> queue)) != 0 || !current_minor -> stats || percpu_init_rwsem(&(current_minor -> spsc_sem)) != 0) {
+		printk(KERN_ALERT "%s: could not allocate memory for current minor %d\n", DEVICE_NAME, minor);
+		pktq_free(&(current_minor -> queue));
+		free_percpu(current_minor -> stats);
+		kfree(current_minor);
+		return NULL;
+	}
+
+	// initialize current minor's default values, the table holds the
+	// first reference
+	kref_init(&(current_minor -> refs));
+	current_minor -> minor = minor;
+	current_minor -> def_segment_size = PKT_DEFAULT_SIZE;
+	current_minor -> file_size  = FILE_DEFAULT_SIZE;
+	current_minor -> read_lowat = 1;
+	current_minor -> write_lowat = 1;
+	current_minor -> atomic_size = min(ATOMIC_DEFAULT_SIZE, FILE_DEFAULT_SIZE);
+	current_minor -> engine = LIST;
+	current_minor -> overflow = OVERFLOW_BLOCK;
+	current_minor -> queue.node = node;
+	current_minor -> numa_pinned = node != NUMA_NO_NODE;
+	current_minor -> pool_node = NUMA_NO_NODE;
+	spin_lock_init(&(current_minor -> waiters_lock));
+	spin_lock_init(&(current_minor -> pool_lock));
+	INIT_LIST_HEAD(&(current_minor -> subscribers));
+
+	// initialize semaphore and wait queues
+	mutex_init(&(current_minor -> open_lock));
+	mutex_init(&(current_minor -> head_lock));
+	mutex_init(&(current_minor -> tail_lock));
+	init_waitqueue_head(&(current_minor -> read_queue));
+	init_waitqueue_head(&(current_minor -> write_queue));
+
+	// the ring engine needs its storage before the first write
+	if (default_engine == RING && set_storage_engine(current_minor, RING) != 0) {
+		printk(KERN_ALERT "%s: could not allocate ring for current minor %d\n", DEVICE_NAME, minor);
+		free_minor(current_minor);
+		return NULL;
+	}
+
+	pr_debug("%s: initialized structures for minor number %d\n", DEVICE_NAME, minor);
+	return current_minor;
+}
+
+/*
+ * find the minor in the table and take a reference on it as a new client,
+ * creating and publishing it if missing
+ * returns with the open lock of the minor held
+ */
+minor_file * get_minor(int minor) {
+	minor_file * current_minor;
+	minor_file * new_minor;
+	void * old;
+
+	for (;;) {
+		rcu_read_lock();
+		current_minor = xa_load(&minor_files, minor);
+		if (current_minor && !kref_get_unless_zero(&(current_minor -> refs))) {
+			// the last reference is being dropped, the slot is about to change
+			rcu_read_unlock();
+			cpu_relax();
+			continue;
+		}
+		rcu_read_unlock();
+
+		if (current_minor) {
+			mutex_lock(&(current_minor -> open_lock));
+			if (!current_minor -> unlinked) {
+				current_minor -> clients++;
+				return current_minor;
+			}
+			// a racing release removed it from the table, look again
+			mutex_unlock(&(current_minor -> open_lock));
+			put_minor(current_minor);
+			continue;
+		}
+
+		// build the minor outside any lock and try to publish it
+		new_minor = alloc_minor(minor);
+		if (!new_minor) return NULL;
+		kref_get(&(new_minor -> refs));
+		new_minor -> clients = 1;
+		mutex_lock(&(new_minor -> open_lock));
+		old = xa_cmpxchg(&minor_files, minor, NULL, new_minor, GFP_KERNEL);
+		if (old == NULL) {
+			create_minor_stats_file(new_minor);
+			return new_minor;
+		}
+
+		// another client published the minor first, or no table node
+		// could be allocated
+		mutex_unlock(&(new_minor -> open_lock));
+		free_minor(new_minor);
+		if (xa_is_err(old)) return NULL;
+	}
+}
+
+static void release_minor(struct kref * refs) {
+	free_minor(container_of(refs, minor_file, refs));
+}
+
+/*
+ * drop a reference on the minor, the last one frees it
+ */
+void put_minor(minor_file * current_minor) {
+	kref_put(&(current_minor -> refs), release_minor);
+}
+
+
+
+/*
+ * Module read and write
+ */
+
+/*
+ * read and write operate on iterators, so that the same paths serve plain
+ * read and write on user buffers and splice on pipe pages
+ */
+ssize_t pktstream_read_iter(struct kiocb *iocb, struct iov_iter *to){
+	struct file *file_p = iocb -> ki_filp;
+	size_t count = iov_iter_count(to);
+	minor_file * current_minor;
+	pktq_read_info info;
+	int minor;
+	int lock_free;
+	int ret;
+	ssize_t already_read;
+	session * current_session;
+	access_mode ac_mode;
+
+	current_session = retrieve_session(file_p, "read");
+	current_minor = current_session -> current_minor;
+	minor = current_minor -> minor;
+
+	// a non-blocking request never sleeps, whatever the session mode
+	ac_mode = (iocb -> ki_flags & IOCB_NOWAIT) ? NON_BLOCK : current_session -> ac_mode;
+
+	follow_reader(current_minor);
+
+	// subscribers read from their own cursor; one whose wait ended with
+	// broadcast disabled reads the shared queue instead
+	if (READ_ONCE(current_minor -> broadcast)) {
+		already_read = broadcast_read(current_session, to, count, ac_mode);
+		if (already_read != 0 || READ_ONCE(current_minor -> broadcast))
+			return already_read;
+	}
+
+	// acquire the head of the queue once there is data to read
+	ret = acquire_readable(current_minor, minor, ac_mode, &lock_free);
+	if (ret == 1) return 0;
+	if (ret != 0) return ret;
+
+	pr_debug("%s: wants to read %zd bytes\n", DEVICE_NAME, count);
+
+	// the ring engine copies out of contiguous storage
+	if (current_minor -> engine == RING) {
+		if (current_session -> op_mode == PACKET)
+			already_read = ring_read_packet(current_minor, to, count);
+		else
+			already_read = ring_read_stream(current_minor, to, count);
+		release_side(current_minor, &(current_minor -> head_lock), lock_free);
+		if (already_read > 0) {
+			minor_stat_add(current_minor, bytes_out, already_read);
+			if (trace_pktstrm_dequeue_enabled())
+				trace_pktstrm_dequeue(minor, already_read, queued_bytes(current_minor));
+		}
+		wake_writers(current_minor);
+		wake_readers(current_minor);
+		return already_read;
+	}
+
+	/* if operative mode is PACKET it must read a single packet;
+	 * any bytes not fitting must be discarded
+	 */
+	if (current_session -> op_mode == PACKET) {
+		pr_debug("%s: reading as packet\n", DEVICE_NAME);
+		already_read = list_read_packet(current_minor, to, count);
+		release_side(current_minor, &(current_minor -> head_lock), lock_free);
+		if (already_read > 0) {
+			minor_stat_add(current_minor, bytes_out, already_read);
+			if (trace_pktstrm_dequeue_enabled())
+				trace_pktstrm_dequeue(minor, already_read, queued_bytes(current_minor));
+		}
+		wake_writers(current_minor);
+		wake_readers(current_minor);
+		return already_read;
+	}
+
+	/*
+	 * otherwise operative mode is STREAM, it must read packets until receiving buffer
+	 * is filled; residual bytes will become a new packet
+	 */
+	pr_debug("%s: reading as stream\n", DEVICE_NAME);
+	memset(&info, 0, sizeof(info));
+	already_read = pktq_read_stream(&(current_minor -> queue), to, count, &info);
+	stat_read(current_minor, &info);
+
+	release_side(current_minor, &(current_minor -> head_lock), lock_free);
+	if (already_read > 0) {
+		minor_stat_add(current_minor, bytes_out, already_read);
+		if (trace_pktstrm_dequeue_enabled())
+			trace_pktstrm_dequeue(minor, already_read, queued_bytes(current_minor));
+	}
+	wake_writers(current_minor);
+	wake_readers(current_minor);
+	return already_read;
+
+}
+
+ssize_t pktstream_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+	struct file *file_p = iocb -> ki_filp;
+	size_t count = iov_iter_count(from);
+	minor_file * current_minor;
+	size_t written;
+	size_t want;
+	size_t need;
+	ssize_t ret;
+	int minor;
+	int atomic;
+	unsigned int lane;
+	overflow_policy policy;
+	session * current_session;
+	access_mode ac_mode;
+
+	current_session = retrieve_session(file_p, "write");
+	current_minor = current_session -> current_minor;
+	minor = current_minor -> minor;
+	ac_mode = (iocb -> ki_flags & IOCB_NOWAIT) ? NON_BLOCK : current_session -> ac_mode;
+
+	pr_debug("%s: writing %zd bytes on %d\n", DEVICE_NAME, count, minor);
+
+	// check size of write is admissible
+	if (count == 0) {
+		pr_debug("%s: warning message size not admissible %zd\n", DEVICE_NAME, count);
+		return -1;
+	}
+
+	// writes go to the lane chosen by the session
+	lane = current_session -> lane;
+
+	/* writes up to the atomic size are queued whole, larger ones are queued
+	 * in parts of whole packets as space becomes available, like a pipe
+	 */
+	atomic = count <= READ_ONCE(current_minor -> atomic_size);
+	written = 0;
+	while (written < count) {
+		want = atomic ? count : writable_bytes(current_minor, lane, count - written);
+		ret = want ? write_part(current_minor, lane, from, want) : -EAGAIN;
+		if (ret > 0) {
+			written += ret;
+			continue;
+		}
+		if (ret != -EAGAIN)
+			return written ? written : ret;
+
+		// a minor dropping its oldest data makes room for the rest of the
+		// write, up to the whole packets fitting in the file size
+		policy = READ_ONCE(current_minor -> overflow);
+		if (policy == OVERFLOW_DROP_OLDEST) {
+			need = atomic ? count : min(count - written,
+				rounddown(current_minor -> file_size, write_unit(current_minor, SIZE_MAX)));
+			if (evict_oldest(current_minor, lane, need) != 0)
+				continue;
+		}
+
+		// if non-blocking, or not blocking on a full minor, return what was
+		// queued so far
+		if (ac_mode == NON_BLOCK || policy != OVERFLOW_BLOCK) {
+			pr_debug("%s: not enough space to write %zd\n", DEVICE_NAME, count - written);
+			minor_stat_add(current_minor, would_block, 1);
+			if (written)
+				return written;
+			return ac_mode == NON_BLOCK ? -EAGAIN : -ENOBUFS;
+		}
+
+		// if blocking put the client process to sleep until the next part fits
+		if (wait_for_space(current_minor, lane, atomic ? count : write_unit(current_minor, count - written))) {
+			pr_debug("%s: interrupted while waiting to write on %d\n", DEVICE_NAME, minor);
+			return written ? written : -ERESTARTSYS;
+		}
+	}
+
+	return written;
+}
+
+/*
+ * queue want bytes of the client buffer as a single part in a lane
+ * returns -EAGAIN, with nothing consumed, if the part does not fit yet
+ */
+ssize_t write_part(minor_file * current_minor, unsigned int lane, struct iov_iter * from, size_t want) {
+	segment * first;
+	segment * last;
+	size_t pkt_size;
+	size_t size_written;
+	int minor;
+	int lock_free;
+	int ret;
+
+	minor = current_minor -> minor;
+
+retry:
+	pkt_size = current_minor -> def_segment_size;
+
+	/* the list engine allocates and fills its segments before taking the
+	 * lock, so a fault on the user buffer does not stall other clients
+	 */
+	first = NULL;
+	last = NULL;
+	if (READ_ONCE(current_minor -> engine) == LIST) {
+		ret = pktq_create_segments(&(current_minor -> queue), pkt_size, want, from, &first, &last);
+		if (ret != 0) {
+			pr_debug("%s: could not create segments for %zd bytes\n", DEVICE_NAME, want);
+			return ret;
+		}
+	}
+
+	// acquire lock on the tail of the queue, readers are not excluded
+	if (acquire_side(current_minor, &(current_minor -> tail_lock), minor, &lock_free) != 0) {
+		if (first != NULL) iov_iter_revert(from, want);
+		release_segment_chain(current_minor, first);
+		return -ERESTARTSYS;
+	}
+
+	// the engine was switched while the data was being prepared
+	if ((current_minor -> engine == LIST) != (first != NULL)) {
+		release_side(current_minor, &(current_minor -> tail_lock), lock_free);
+		if (first != NULL) iov_iter_revert(from, want);
+		release_segment_chain(current_minor, first);
+		goto retry;
+	}
+
+	// subscribers only read the first lane
+	if (current_minor -> broadcast)
+		lane = 0;
+
+	// check the part could ever fit in the minor file, next to the space
+	// reserved to other lanes
+	if (!pktq_admissible(want + (reserves_apply(current_minor) ? reserved_bytes(current_minor, lane) : 0), current_minor -> file_size) ||
+			(current_minor -> engine == RING && DIV_ROUND_UP(want, pkt_size) > minor_ring(current_minor) -> pkt_slots)) {
+		pr_debug("%s: warning message size not admissible %zd\n", DEVICE_NAME, want);
+		release_side(current_minor, &(current_minor -> tail_lock), lock_free);
+		if (first != NULL) iov_iter_revert(from, want);
+		release_segment_chain(current_minor, first);
+		return -1;
+	}
+
+	// check if new data would not fit in current available space
+	if (!lane_has_space(current_minor, lane, want)) {
+		release_side(current_minor, &(current_minor -> tail_lock), lock_free);
+		if (first != NULL) iov_iter_revert(from, want);
+		release_segment_chain(current_minor, first);
+		return -EAGAIN;
+	}
+
+	// the ring engine copies the whole part into its storage
+	if (current_minor -> engine == RING)
+		size_written = ring_append(current_minor, want, from);
+	else
+		size_written = pktq_append(&(current_minor -> queue), lane, first, last, want);
+
+	release_side(current_minor, &(current_minor -> tail_lock), lock_free);
+	if (size_written > 0) {
+		minor_stat_add(current_minor, pkts_in, DIV_ROUND_UP(size_written, pkt_size));
+		minor_stat_add(current_minor, bytes_in, size_written);
+		stat_queued(current_minor, queued_bytes(current_minor));
+		if (trace_pktstrm_enqueue_enabled())
+			trace_pktstrm_enqueue(minor, size_written, queued_bytes(current_minor));
+	}
+
+	// wake up a reader, and the next writer if space is left
+	wake_readers(current_minor);
+	wake_writers(current_minor);
+	return size_written ? size_written : -EFAULT;
+}
+
+
+
+/*
+ * read up to max_pkts packets into a single buffer with one acquisition of
+ * the head of the queue; packets keep their boundaries whatever the mode
+ * and are read whole, except the first one which is truncated like a
+ * packet mode read if larger than the buffer
+ */
+long pktstream_read_batch(session * current_session, pktstrm_batch * user_batch) {
+	minor_file * current_minor;
+	pktstrm_batch batch;
+	struct iov_iter to;
+	size_t pkt_size;
+	ssize_t to_read;
+	long num_pkts;
+	int minor;
+	int lock_free;
+	int ret;
+
+	current_minor = current_session -> current_minor;
+	minor = current_minor -> minor;
+
+	// subscribers read from their own cursor, one read at a time
+	if (READ_ONCE(current_minor -> broadcast))
+		return -EINVAL;
+	if (copy_from_user(&batch, user_batch, sizeof(pktstrm_batch)) != 0)
+		return -EFAULT;
+	if (batch.max_pkts == 0 || batch.size == 0)
+		return 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	if (import_ubuf(ITER_DEST, batch.buff, batch.size, &to) != 0)
+		return -EFAULT;
+#else
+	{
+		struct iovec iov;
+		if (import_single_range(READ, batch.buff, batch.size, &iov, &to) != 0)
+			return -EFAULT;
+	}
+#endif
+
+	follow_reader(current_minor);
+
+	// acquire the head of the queue once there is data to read
+	ret = acquire_readable(current_minor, minor, current_session -> ac_mode, &lock_free);
+	if (ret == 1) return 0;
+	if (ret != 0) return ret;
+
+	for (num_pkts = 0; num_pkts < batch.max_pkts && has_data(current_minor); num_pkts++) {
+		pkt_size = next_packet_size(current_minor);
+		if (num_pkts > 0 && pkt_size > iov_iter_count(&to))
+			break;
+
+		// store the length first, a fault must not lose the packet
+		to_read = min(pkt_size, iov_iter_count(&to));
+		if (put_user((unsigned int) to_read, batch.lengths + num_pkts) != 0)
+			break;
+
+		if (current_minor -> engine == RING)
+			to_read = ring_read_packet(current_minor, &to, iov_iter_count(&to));
+		else
+			to_read = list_read_packet(current_minor, &to, iov_iter_count(&to));
+		if (to_read < 0)
+			break;
+	}
+
+	release_side(current_minor, &(current_minor -> head_lock), lock_free);
+	if (num_pkts > 0) {
+		minor_stat_add(current_minor, bytes_out, batch.size - iov_iter_count(&to));
+		if (trace_pktstrm_dequeue_enabled())
+			trace_pktstrm_dequeue(minor, batch.size - iov_iter_count(&to), queued_bytes(current_minor));
+	}
+	wake_writers(current_minor);
+	wake_readers(current_minor);
+	return num_pkts > 0 ? num_pkts : -EFAULT;
+}
+
+
+
+/*
+ * Broadcast mode
+ *
+ * Every reading session is a subscriber with its own cursor: the last
+ * segment it consumed and the bytes it already read of the following one.
+ * Readers never modify shared segments; the queue head only moves past a
+ * segment once every subscriber did, so the file size bounds the data not
+ * yet read by the slowest subscriber. Subscribers serialize on the head lock.
+ */
+
+/*
+ * attach a reading session at the head of the queue, it will receive all
+ * the data still buffered
+ * must be called holding the head lock
+ */
+void subscribe(minor_file * current_minor, session * current_session) {
+	current_session -> cursor = current_minor -> queue.lanes[0].first_segment;
+	current_session -> cursor_seq = current_minor -> queue.lanes[0].first_segment -> seq;
+	current_session -> cursor_offset = 0;
+	list_add_tail(&(current_session -> subscriber), &(current_minor -> subscribers));
+}
+
+/*
+ * the subscriber has data past its cursor; reads no segment, so it can be
+ * used as a wait condition without holding the head lock
+ */
+int subscriber_has_data(session * current_session) {
+	return smp_load_acquire(&(current_session -> current_minor -> queue.lanes[0].last_seq)) != READ_ONCE(current_session -> cursor_seq);
+}
+
+/*
+ * free the segments every subscriber has moved past
+ * must be called holding the head lock
+ */
+void broadcast_release(minor_file * current_minor) {
+	session * current_session;
+	segment * dummy_segment;
+	segment * next;
+	unsigned long min_seq;
+
+	if (list_empty(&(current_minor -> subscribers)))
+		return;
+
+	min_seq = ULONG_MAX;
+	list_for_each_entry(current_session, &(current_minor -> subscribers), subscriber)
+		min_seq = min(min_seq, current_session -> cursor_seq);
+
+	// the oldest cursor becomes the dummy of the queue
+	dummy_segment = current_minor -> queue.lanes[0].first_segment;
+	while (dummy_segment -> seq != min_seq) {
+		next = dummy_segment -> next;
+		pktq_advance(&(current_minor -> queue.lanes[0]), next);
+		release_bytes(current_minor, next -> segment_size);
+		release_segment(current_minor, dummy_segment);
+		dummy_segment = next;
+	}
+}
+
+/*
+ * read from the cursor of the session, a single packet or up to count
+ * bytes across packets depending on the session mode
+ */
+ssize_t broadcast_read(session * current_session, struct iov_iter * to, size_t count, access_mode ac_mode) {
+	minor_file * current_minor;
+	segment * current_segment;
+	size_t available;
+	size_t to_read;
+	ssize_t already_read;
+
+	current_minor = current_session -> current_minor;
+	if (acquire_lock(&(current_minor -> head_lock), current_minor -> minor) != 0) return -ERESTARTSYS;
+
+	// a disabled broadcast also ends the wait, the caller then retries on
+	// the shared queue
+	while (current_minor -> broadcast && smp_load_acquire(&(current_session -> cursor -> next)) == NULL) {
+		mutex_unlock(&(current_minor -> head_lock));
+		if (ac_mode == NON_BLOCK) {
+			minor_stat_add(current_minor, would_block, 1);
+			return 0;
+		}
+		if (wait_event_interruptible(current_minor -> read_queue,
+				subscriber_has_data(current_session) || !READ_ONCE(current_minor -> broadcast)))
+			return -ERESTARTSYS;
+		if (acquire_lock(&(current_minor -> head_lock), current_minor -> minor) != 0) return -ERESTARTSYS;
+	}
+
+	already_read = 0;
+	current_segment = current_minor -> broadcast ? smp_load_acquire(&(current_session -> cursor -> next)) : NULL;
+	while (current_segment != NULL && already_read < count) {
+		available = current_segment -> segment_size - current_session -> cursor_offset;
+		to_read = min(available, count - already_read);
+		if (copy_to_iter(current_segment -> segment_buffer + current_segment -> segment_offset + current_session -> cursor_offset, to_read, to) != to_read) {
+			if (already_read == 0) already_read = -EFAULT;
+			break;
+		}
+		already_read += to_read;
+		if (current_segment -> node != numa_node_id())
+			minor_stat_add(current_minor, remote_bytes, to_read);
+
+		// a stream read keeps the residual for the next read of this session
+		if (to_read < available && current_session -> op_mode == STREAM) {
+			current_session -> cursor_offset += to_read;
+			minor_stat_add(current_minor, splits, 1);
+			trace_pktstrm_split(current_minor -> minor, to_read, available - to_read);
+			break;
+		}
+		if (to_read < available) {
+			minor_stat_add(current_minor, bytes_dropped, available - to_read);
+			trace_pktstrm_drop(current_minor -> minor, available - to_read);
+		}
+
+		current_session -> cursor = current_segment;
+		current_session -> cursor_offset = 0;
+		WRITE_ONCE(current_session -> cursor_seq, current_segment -> seq);
+		minor_stat_add(current_minor, pkts_out, 1);
+		if (current_session -> op_mode == PACKET)
+			break;
+		current_segment = smp_load_acquire(&(current_segment -> next));
+	}
+
+	broadcast_release(current_minor);
+	mutex_unlock(&(current_minor -> head_lock));
+	if (already_read > 0) {
+		minor_stat_add(current_minor, bytes_out, already_read);
+		if (trace_pktstrm_dequeue_enabled())
+			trace_pktstrm_dequeue(current_minor -> minor, already_read, queued_bytes(current_minor));
+	}
+	wake_writers(current_minor);
+	return already_read;
+}
+
+/*
+ * switch the minor to broadcast mode, only with the list engine and no
+ * data queued, or back to shared consumption
+ */
+long request_broadcast(minor_file * current_minor, int enabled) {
+	session * current_session;
+	long ret;
+
+	ret = 0;
+	if (acquire_lock(&(current_minor -> open_lock), current_minor -> minor) != 0) return -ERESTARTSYS;
+
+	// lock-free clients leave first, subscribers always take the head lock
+	percpu_down_write(&(current_minor -> spsc_sem));
+	mutex_lock(&(current_minor -> head_lock));
+	mutex_lock(&(current_minor -> tail_lock));
+	if (enabled && !current_minor -> broadcast && (current_minor -> engine != LIST || queued_bytes(current_minor) != 0)) {
+		printk(KERN_ALERT "%s: broadcast needs an empty minor using the list engine\n", DEVICE_NAME);
+		ret = -1;
+	} else if (enabled && current_minor -> overflow == OVERFLOW_DROP_OLDEST) {
+		printk(KERN_ALERT "%s: broadcast cannot drop the oldest data of a minor\n", DEVICE_NAME);
+		ret = -1;
+	} else if (enabled && !current_minor -> broadcast) {
+		// cursors are not maintained outside broadcast mode
+		list_for_each_entry(current_session, &(current_minor -> subscribers), subscriber) {
+			current_session -> cursor = current_minor -> queue.lanes[0].first_segment;
+			current_session -> cursor_seq = current_minor -> queue.lanes[0].first_segment -> seq;
+			current_session -> cursor_offset = 0;
+		}
+		current_minor -> broadcast = 1;
+		current_minor -> spsc = 0;
+	} else if (!enabled) {
+		current_minor -> broadcast = 0;
+	}
+	unlock_minor(current_minor);
+	percpu_up_write(&(current_minor -> spsc_sem));
+
+	update_spsc(current_minor);
+	mutex_unlock(&(current_minor -> open_lock));
+
+	// subscribers waiting on their cursor go back to the shared queue
+	wake_up_interruptible_all(&(current_minor -> read_queue));
+	return ret;
+}
+
+
+
+/*
+ * Overflow policy
+ *
+ * A full minor makes writers sleep until readers free space, fail at once,
+ * or evict the oldest packets from the head of the queue. Evicting writers
+ * take the head lock, so readers cannot use the lock-free path meanwhile,
+ * and subscribers never lose data they have not read. Evictions are kept
+ * until a reader collects them with PKTSTRM_IOCTL_GET_DROPS, and polling
+ * reports them as priority data.
+ */
+
+/*
+ * change the overflow policy of the minor
+ */
+long request_overflow(minor_file * current_minor, unsigned long policy) {
+	long ret;
+
+	if (policy > OVERFLOW_DROP_OLDEST) {
+		printk(KERN_ALERT "%s: ioctl invalid overflow policy %lu\n", DEVICE_NAME, policy);
+		return -1;
+	}
+
+	ret = 0;
+	if (acquire_lock(&(current_minor -> open_lock), current_minor -> minor) != 0) return -ERESTARTSYS;
+
+	// lock-free clients leave first, evicting writers take the head lock
+	percpu_down_write(&(current_minor -> spsc_sem));
+	mutex_lock(&(current_minor -> head_lock));
+	mutex_lock(&(current_minor -> tail_lock));
+	if (policy == OVERFLOW_DROP_OLDEST && current_minor -> broadcast) {
+		printk(KERN_ALERT "%s: broadcast cannot drop the oldest data of a minor\n", DEVICE_NAME);
+		ret = -1;
+	} else {
+		WRITE_ONCE(current_minor -> overflow, policy);
+		if (policy == OVERFLOW_DROP_OLDEST)
+			current_minor -> spsc = 0;
+	}
+	unlock_minor(current_minor);
+	percpu_up_write(&(current_minor -> spsc_sem));
+
+	update_spsc(current_minor);
+	mutex_unlock(&(current_minor -> open_lock));
+
+	// writers sleeping for space only keep waiting when blocking
+	wake_up_interruptible_all(&(current_minor -> write_queue));
+	return ret;
+}
+
+/*
+ * discard packets from the head of the queue until count more bytes fit in
+ * lane, lowest lanes first and never from a higher lane; returns the
+ * number of packets discarded
+ * a mapped ring is consumed in place and is never evicted
+ */
+size_t evict_oldest(minor_file * current_minor, unsigned int lane, size_t count) {
+	size_t pkts;
+	size_t bytes;
+	size_t dropped;
+	int lock_free;
+
+	if (acquire_side(current_minor, &(current_minor -> head_lock), current_minor -> minor, &lock_free) != 0)
+		return 0;
+
+	pkts = 0;
+	bytes = 0;
+	if (current_minor -> engine == LIST || atomic_read(&(current_minor -> ring_mappings)) == 0) {
+		while (!lane_has_space(current_minor, lane, count)) {
+			if (current_minor -> engine == RING)
+				dropped = has_data(current_minor) ? ring_drop_packet(current_minor) : 0;
+			else
+				dropped = pktq_drop_packet(&(current_minor -> queue), lane);
+			if (dropped == 0)
+				break;
+			bytes += dropped;
+			pkts++;
+		}
+	}
+	release_side(current_minor, &(current_minor -> head_lock), lock_free);
+
+	if (pkts > 0) {
+		atomic_long_add(bytes, &(current_minor -> drops_bytes));
+		atomic_long_add(pkts, &(current_minor -> drops_pkts));
+		minor_stat_add(current_minor, evicted_pkts, pkts);
+		minor_stat_add(current_minor, evicted_bytes, bytes);
+		trace_pktstrm_evict(current_minor -> minor, pkts, bytes);
+	}
+	return pkts;
+}
+
+/*
+ * hand the evictions since the last report to the reader, and reset them
+ */
+long report_drops(minor_file * current_minor, pktstrm_drops * user_drops) {
+	pktstrm_drops drops;
+
+	drops.pkts = atomic_long_xchg(&(current_minor -> drops_pkts), 0);
+	drops.bytes = atomic_long_xchg(&(current_minor -> drops_bytes), 0);
+	if (copy_to_user(user_drops, &drops, sizeof(pktstrm_drops)) != 0) {
+		atomic_long_add(drops.pkts, &(current_minor -> drops_pkts));
+		atomic_long_add(drops.bytes, &(current_minor -> drops_bytes));
+		return -EFAULT;
+	}
+	return 0;
+}
+
+
+
+/*
+ * Module statistics
+ */
+
+/*
+ * record the amount of queued bytes after a write, the peak is kept per
+ * cpu and the highest one is reported
+ */
+void stat_queued(minor_file * current_minor, size_t queued) {
+	if (queued > this_cpu_read(current_minor -> stats -> peak_queued))
+		this_cpu_write(current_minor -> stats -> peak_queued, queued);
+}
+
+static int pktstream_stats_show(struct seq_file * seq, void * unused) {
+	minor_file * current_minor = seq -> private;
+	minor_stats total;
+	minor_stats * cpu_stats;
+	unsigned int lane;
+	int cpu;
+
+	memset(&total, 0, sizeof(minor_stats));
+	for_each_possible_cpu(cpu) {
+		cpu_stats = per_cpu_ptr(current_minor -> stats, cpu);
+		total.pkts_in += cpu_stats -> pkts_in;
+		total.bytes_in += cpu_stats -> bytes_in;
+		total.pkts_out += cpu_stats -> pkts_out;
+		total.bytes_out += cpu_stats -> bytes_out;
+		total.bytes_dropped += cpu_stats -> bytes_dropped;
+		total.splits += cpu_stats -> splits;
+		total.blocked_reads += cpu_stats -> blocked_reads;
+		total.blocked_writes += cpu_stats -> blocked_writes;
+		total.read_wait_ns += cpu_stats -> read_wait_ns;
+		total.write_wait_ns += cpu_stats -> write_wait_ns;
+		total.would_block += cpu_stats -> would_block;
+		total.evicted_pkts += cpu_stats -> evicted_pkts;
+		total.evicted_bytes += cpu_stats -> evicted_bytes;
+		total.lock_contended += cpu_stats -> lock_contended;
+		total.remote_bytes += cpu_stats -> remote_bytes;
+		total.peak_queued = max(total.peak_queued, cpu_stats -> peak_queued);
+	}
+
+	seq_printf(seq, "packets_in: %llu\n", total.pkts_in);
+	seq_printf(seq, "bytes_in: %llu\n", total.bytes_in);
+	seq_printf(seq, "packets_out: %llu\n", total.pkts_out);
+	seq_printf(seq, "bytes_out: %llu\n", total.bytes_out);
+	seq_printf(seq, "bytes_dropped: %llu\n", total.bytes_dropped);
+	seq_printf(seq, "splits: %llu\n", total.splits);
+	seq_printf(seq, "blocked_reads: %llu\n", total.blocked_reads);
+	seq_printf(seq, "blocked_writes: %llu\n", total.blocked_writes);
+	seq_printf(seq, "read_wait_ns: %llu\n", total.read_wait_ns);
+	seq_printf(seq, "write_wait_ns: %llu\n", total.write_wait_ns);
+	seq_printf(seq, "would_block: %llu\n", total.would_block);
+	seq_printf(seq, "evicted_packets: %llu\n", total.evicted_pkts);
+	seq_printf(seq, "evicted_bytes: %llu\n", total.evicted_bytes);
+	seq_printf(seq, "lock_contended: %llu\n", total.lock_contended);
+	seq_printf(seq, "remote_bytes: %llu\n", total.remote_bytes);
+	seq_printf(seq, "peak_queued: %llu\n", total.peak_queued);
+	seq_printf(seq, "queued: %zu\n", queued_bytes(current_minor));
+	seq_printf(seq, "file_size: %zu\n", current_minor -> file_size);
+	seq_printf(seq, "segment_size: %zu\n", current_minor -> def_segment_size);
+	seq_printf(seq, "lanes_queued:");
+	for (lane = 0; lane < PKTSTRM_LANES; lane++)
+		seq_printf(seq, " %zu", pktq_lane_queued(&(current_minor -> queue), lane));
+	seq_printf(seq, "\n");
+	seq_printf(seq, "lanes_reserved:");
+	for (lane = 0; lane < PKTSTRM_LANES; lane++)
+		seq_printf(seq, " %zu", current_minor -> lane_reserve[lane]);
+	seq_printf(seq, "\n");
+	seq_printf(seq, "numa_node: %d%s\n", READ_ONCE(current_minor -> queue.node),
+		current_minor -> numa_pinned ? "" : " (follows reader)");
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(pktstream_stats);
+
+/*
+ * expose the counters of a minor as pktstrm/<minor> in debugfs,
+ * the file is removed by free_minor
+ */
+void create_minor_stats_file(minor_file * current_minor) {
+	char name[16];
+
+	snprintf(name, sizeof(name), "%d", current_minor -> minor);
+	current_minor -> stats_file = debugfs_create_file(name, 0444, debugfs_dir, current_minor, &pktstream_stats_fops);
+}
+
+
+
+/*
+ * Module poll
+ */
+
+/*
+ * report readiness of the minor, registering on both wait queues so that
+ * the wake ups of read and write operations also wake pollers
+ */
+__poll_t pktstream_poll(struct file *file_p, struct poll_table_struct *wait) {
+	minor_file * current_minor;
+	__poll_t mask;
+	int minor;
+
+	current_minor = retrieve_minor(file_p, "poll");
+	minor = current_minor -> minor;
+
+	poll_wait(file_p, &current_minor -> read_queue, wait);
+	poll_wait(file_p, &current_minor -> write_queue, wait);
+
+	// readiness follows the low watermarks, like the wakeups; a
+	// subscriber is readable when data follows its own cursor, only
+	// reading sessions are subscribed
+	mask = 0;
+	if (READ_ONCE(current_minor -> broadcast) && (file_p -> f_mode & FMODE_READ) ?
+			subscriber_has_data(file_p -> private_data) : above_read_lowat(current_minor))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (above_write_lowat(current_minor))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	// packets were evicted since a reader last collected the drops
+	if (atomic_long_read(&(current_minor -> drops_pkts)) != 0)
+		mask |= EPOLLPRI;
+
+	return mask;
+}
+
+
+
+/*
+ * Helper functions
+ */
+
+/*
+ * retrieve the minor file from file pointer
+ * the open file holds a reference, so the minor stays valid until release
+ */
+minor_file * retrieve_minor(struct file *file_p, char * operation) {
+	return retrieve_session(file_p, operation) -> current_minor;
+}
+
+/*
+ * retrieve the session of the open file
+ */
+session * retrieve_session(struct file *file_p, char * operation) {
+	session * current_session;
+
+	current_session = file_p -> private_data;
+	pr_debug("%s: %s on minor number %d\n", DEVICE_NAME, operation, current_session -> current_minor -> minor);
+	return current_session;
+}
+
+/*
+ * pop the first segment as a single packet, bytes not fitting in the
+ * buffer are discarded
+ * must be called holding the head side, with data available
+ */
+ssize_t list_read_packet(minor_file * current_minor, struct iov_iter * to, size_t count) {
+	pktq_read_info info;
+	ssize_t ret;
+
+	memset(&info, 0, sizeof(info));
+	ret = pktq_read_packet(&(current_minor -> queue), to, count, &info);
+	stat_read(current_minor, &info);
+	return ret;
+}
+
+/*
+ * account packets consumed by a read of the list engine
+ */
+void stat_read(minor_file * current_minor, pktq_read_info * info) {
+	minor_stat_add(current_minor, pkts_out, info -> pkts);
+	if (info -> split) {
+		minor_stat_add(current_minor, splits, 1);
+		trace_pktstrm_split(current_minor -> minor, info -> split, info -> residual);
+	}
+	if (info -> dropped) {
+		minor_stat_add(current_minor, bytes_dropped, info -> dropped);
+		trace_pktstrm_drop(current_minor -> minor, info -> dropped);
+	}
+	if (info -> remote)
+		minor_stat_add(current_minor, remote_bytes, info -> remote);
+}
+
+/*
+ * unless pinned, new segments of a minor are allocated on the node of the
+ * task reading them, so that the copies to the reader stay local
+ */
+void follow_reader(minor_file * current_minor) {
+	int node;
+
+	node = numa_node_id();
+	if (!READ_ONCE(current_minor -> numa_pinned) && READ_ONCE(current_minor -> queue.node) != node)
+		WRITE_ONCE(current_minor -> queue.node, node);
+}
+
+/*
+ * size of the packet at the head of the queue
+ * must be called holding the head side, with data available
+ */
+size_t next_packet_size(minor_file * current_minor) {
+	ring * data_ring;
+
+	if (current_minor -> engine == RING) {
+		data_ring = minor_ring(current_minor);
+		return min_t(size_t, data_ring -> lengths[data_ring -> ctrl -> pkt_tail & (data_ring -> pkt_slots - 1)], ring_queued(data_ring));
+	}
+	return pktq_next_packet_size(&(current_minor -> queue));
+}
+
+/*
+ * free every segment of a minor file, dummy segment and pool included
+ */
+void free_minor_segments(minor_file * current_minor) {
+	segment * pool;
+
+	// the shrinker may still be looking at the pool
+	spin_lock(&(current_minor -> pool_lock));
+	pool = current_minor -> pool;
+	current_minor -> pool = NULL;
+	current_minor -> pool_count = 0;
+	current_minor -> pool_target = 0;
+	spin_unlock(&(current_minor -> pool_lock));
+	free_segment_chain(pool);
+
+	pktq_free(&(current_minor -> queue));
+}
+
+/*
+ * check if count more bytes fit in the minor file
+ * the ring engine also needs a free packet boundary slot for each packet
+ */
+int has_space(minor_file * current_minor, size_t count) {
+	ring * data_ring;
+	size_t pkts;
+	int fits;
+
+	if (!pktq_has_space(queued_bytes(current_minor), count, current_minor -> file_size))
+		return 0;
+	if (READ_ONCE(current_minor -> engine) != RING)
+		return 1;
+
+	// a ring being released is empty
+	fits = 1;
+	pkts = DIV_ROUND_UP(count, current_minor -> def_segment_size);
+	rcu_read_lock();
+	data_ring = rcu_dereference(current_minor -> data_ring);
+	if (data_ring)
+		fits = data_ring -> ctrl -> pkt_head - READ_ONCE(data_ring -> ctrl -> pkt_tail) + pkts <= data_ring -> pkt_slots;
+	rcu_read_unlock();
+	return fits;
+}
+
+/*
+ * lane reservations only bind writers of the list engine out of broadcast
+ * mode, the ring and subscribers use a single lane
+ */
+int reserves_apply(minor_file * current_minor) {
+	return READ_ONCE(current_minor -> engine) != RING && !READ_ONCE(current_minor -> broadcast);
+}
+
+/*
+ * bytes of the file size reserved to the lanes other than lane, and the
+ * part of them their data does not use yet
+ */
+size_t reserved_bytes(minor_file * current_minor, unsigned int lane) {
+	size_t reserved;
+	unsigned int other;
+
+	reserved = 0;
+	for (other = 0; other < PKTSTRM_LANES; other++)
+		if (other != lane)
+			reserved += current_minor -> lane_reserve[other];
+	return reserved;
+}
+
+size_t unused_reserve(minor_file * current_minor, unsigned int lane) {
+	size_t reserved;
+	size_t queued;
+	unsigned int other;
+
+	reserved = 0;
+	if (!reserves_apply(current_minor))
+		return 0;
+	for (other = 0; other < PKTSTRM_LANES; other++) {
+		if (other == lane)
+			continue;
+		queued = pktq_lane_queued(&(current_minor -> queue), other);
+		if (queued < current_minor -> lane_reserve[other])
+			reserved += current_minor -> lane_reserve[other] - queued;
+	}
+	return reserved;
+}
+
+/*
+ * check if count more bytes fit in a lane, leaving the space reserved to
+ * the other lanes
+ */
+int lane_has_space(minor_file * current_minor, unsigned int lane, size_t count) {
+	return has_space(current_minor, count + unused_reserve(current_minor, lane));
+}
+
+/*
+ * bytes of a write of count bytes that fit in a lane of the minor file now;
+ * a write not fitting whole is cut to whole packets, so its packets are the
+ * same it would have been split in by a single part
+ */
+size_t writable_bytes(minor_file * current_minor, unsigned int lane, size_t count) {
+	ring * data_ring;
+	size_t queued;
+	size_t space;
+	size_t free_slots;
+
+	queued = queued_bytes(current_minor) + unused_reserve(current_minor, lane);
+	space = queued < current_minor -> file_size ? current_minor -> file_size - queued : 0;
+	if (READ_ONCE(current_minor -> engine) == RING) {
+		rcu_read_lock();
+		data_ring = rcu_dereference(current_minor -> data_ring);
+		if (data_ring) {
+			free_slots = data_ring -> pkt_slots - (data_ring -> ctrl -> pkt_head - READ_ONCE(data_ring -> ctrl -> pkt_tail));
+			space = min(space, free_slots * current_minor -> def_segment_size);
+		}
+		rcu_read_unlock();
+	}
+
+	if (count <= space)
+		return count;
+	return rounddown(space, write_unit(current_minor, SIZE_MAX));
+}
+
+/*
+ * smallest part a write of count bytes can be queued in
+ */
+size_t write_unit(minor_file * current_minor, size_t count) {
+	return min3(count, current_minor -> def_segment_size, current_minor -> file_size);
+}
+
+/*
+ * check if published data is available to readers
+ * pairs with the release stores of writers publishing new data
+ */
+int has_data(minor_file * current_minor) {
+	ring * data_ring;
+	int ret;
+
+	if (READ_ONCE(current_minor -> engine) != RING)
+		return pktq_has_data(&(current_minor -> queue));
+
+	ret = 0;
+	rcu_read_lock();
+	data_ring = rcu_dereference(current_minor -> data_ring);
+	if (data_ring)
+		ret = smp_load_acquire(&(data_ring -> ctrl -> pkt_head)) != READ_ONCE(data_ring -> ctrl -> pkt_tail);
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * data reaches the read low watermark
+ */
+int above_read_lowat(minor_file * current_minor) {
+	return has_data(current_minor) && queued_bytes(current_minor) >= current_minor -> read_lowat;
+}
+
+/*
+ * free space reaches the write low watermark
+ */
+int above_write_lowat(minor_file * current_minor) {
+	return has_space(current_minor, current_minor -> write_lowat);
+}
+
+/*
+ * wake sleepers, and all pollers, once their watermark is reached; a single
+ * reader is woken and one leaving the condition true wakes the next one,
+ * writers are all woken since each waits for space for its own part
+ */
+void wake_readers(minor_file * current_minor) {
+	if (!wq_has_sleeper(&(current_minor -> read_queue)))
+		return;
+
+	// every subscriber has to see the new data
+	if (READ_ONCE(current_minor -> broadcast))
+		wake_up_interruptible_all(&(current_minor -> read_queue));
+	else if (above_read_lowat(current_minor))
+		wake_up_interruptible(&(current_minor -> read_queue));
+}
+
+void wake_writers(minor_file * current_minor) {
+	if (wq_has_sleeper(&(current_minor -> write_queue)) && above_write_lowat(current_minor))
+		wake_up_interruptible(&(current_minor -> write_queue));
+}
+
+/*
+ * amount of bytes currently queued or reserved by writers
+ * the ring engine accounts through its indices, which may be moved in place
+ */
+size_t queued_bytes(minor_file * current_minor) {
+	ring * data_ring;
+	size_t queued;
+
+	if (READ_ONCE(current_minor -> engine) != RING)
+		return pktq_queued(&(current_minor -> queue));
+
+	queued = 0;
+	rcu_read_lock();
+	data_ring = rcu_dereference(current_minor -> data_ring);
+	if (data_ring)
+		queued = ring_queued(data_ring);
+	rcu_read_unlock();
+	return queued;
+}
+
+/*
+ * give back to writers the space of count consumed bytes of the first
+ * lane, the only one used in broadcast mode
+ * the consumed data must not be accessed anymore
+ */
+void release_bytes(minor_file * current_minor, size_t count) {
+	pktq_release_bytes(&(current_minor -> queue), &(current_minor -> queue.lanes[0]), count);
+}
+
+/*
+ * switch the storage engine of an empty minor file
+ * the ring is published before the engine and the engine switched before
+ * the ring is dropped, lockless readers finding no ring see it empty
+ */
+int set_storage_engine(minor_file * current_minor, storage_engine engine) {
+	ring * data_ring;
+
+	if (current_minor -> engine == engine)
+		return 0;
+	if (queued_bytes(current_minor) != 0)
+		return -1;
+
+	if (engine == RING) {
+		data_ring = ring_alloc(current_minor -> file_size);
+		if (!data_ring)
+			return -1;
+		rcu_assign_pointer(current_minor -> data_ring, data_ring);
+		smp_store_release(&(current_minor -> engine), engine);
+	} else {
+		if (atomic_read(&(current_minor -> ring_mappings)) != 0)
+			return -1;
+		WRITE_ONCE(current_minor -> engine, engine);
+		data_ring = minor_ring(current_minor);
+		RCU_INIT_POINTER(current_minor -> data_ring, NULL);
+		ring_release_deferred(data_ring);
+	}
+	sync_ring_waiters(current_minor);
+	return 0;
+}
+
+/*
+ * print the byte content of a buffer
+ */
+void print_bytes(byte * buff, unsigned int cur_size) {
+	int i;
+
+	pr_debug("%s: %d bytes ", DEVICE_NAME, cur_size);
+	for (i = 0; i < cur_size; i++)
+		pr_debug("%02X ", buff[i]);
+	pr_debug("\n");
+}
+
+/*
+ * acquire a lock of the specified minor file
+ * if interrupted exit signaling interruption
+ */
+int acquire_lock(struct mutex * lock, int minor) {
+	if (mutex_lock_interruptible(lock) != 0){
+		pr_debug("%s: could not hold lock on minor %d\n", DEVICE_NAME, minor);
+		return -ERESTARTSYS;
+	}
+	return 0;
+}
+
+/*
+ * acquire both head and tail locks of a minor file, always in this order
+ */
+int lock_minor(minor_file * current_minor, int minor) {
+	if (acquire_lock(&(current_minor -> head_lock), minor) != 0)
+		return -ERESTARTSYS;
+	if (acquire_lock(&(current_minor -> tail_lock), minor) != 0) {
+		mutex_unlock(&(current_minor -> head_lock));
+		return -ERESTARTSYS;
+	}
+	return 0;
+}
+
+void unlock_minor(minor_file * current_minor) {
+	mutex_unlock(&(current_minor -> tail_lock));
+	mutex_unlock(&(current_minor -> head_lock));
+}
+
+/*
+ * acquire the head side of the queue once data is available, sleeping if
+ * the access mode is blocking
+ * returns 0 holding the side, 1 if non-blocking and empty, an error otherwise
+ */
+int acquire_readable(minor_file * current_minor, int minor, access_mode ac_mode, int * lock_free) {
+	// acquire lock on the head of the queue, writers are not excluded
+	if(acquire_side(current_minor, &(current_minor -> head_lock), minor, lock_free) != 0) return -ERESTARTSYS;
+
+	// check if there is no data to read, a blocking reader also waits
+	// for the read low watermark
+	while (ac_mode == NON_BLOCK ? !has_data(current_minor) : !above_read_lowat(current_minor)){
+		release_side(current_minor, &(current_minor -> head_lock), *lock_free);
+
+		// if non-blocking exit with error
+		if (ac_mode == NON_BLOCK) {
+			pr_debug("%s: reading empty file %d\n", DEVICE_NAME, minor);
+			minor_stat_add(current_minor, would_block, 1);
+			return 1;
+		}
+
+		// if blocking put the client process to sleep
+		if (wait_for_data(current_minor)){
+			pr_debug("%s: interrupted while waiting to read %d\n", DEVICE_NAME, minor);
+			return -ERESTARTSYS;
+		}
+		if (acquire_side(current_minor, &(current_minor -> head_lock), minor, lock_free) != 0) return -ERESTARTSYS;
+	}
+	return 0;
+}
+
+/*
+ * acquire one side of the queue: the lock passed, or nothing if the minor
+ * has a single reader and a single writer and uses the lock-free path
+ */
+int acquire_side(minor_file * current_minor, struct mutex * lock, int minor, int * lock_free) {
+	percpu_down_read(&(current_minor -> spsc_sem));
+	if (current_minor -> spsc) {
+		*lock_free = 1;
+		return 0;
+	}
+	percpu_up_read(&(current_minor -> spsc_sem));
+
+	*lock_free = 0;
+	if (mutex_trylock(lock))
+		return 0;
+	minor_stat_add(current_minor, lock_contended, 1);
+	return acquire_lock(lock, minor);
+}
+
+void release_side(minor_file * current_minor, struct mutex * lock, int lock_free) {
+	if (lock_free)
+		percpu_up_read(&(current_minor -> spsc_sem));
+	else
+		mutex_unlock(lock);
+}
+
+/*
+ * enable the lock-free path if requested and there is at most one reader
+ * and one writer, disable it otherwise
+ * must be called holding the open lock of the minor
+ */
+void update_spsc(minor_file * current_minor) {
+	int spsc;
+
+	spsc = current_minor -> spsc_requested && !current_minor -> broadcast &&
+		current_minor -> overflow != OVERFLOW_DROP_OLDEST &&
+		current_minor -> readers <= 1 && current_minor -> writers <= 1;
+	if (spsc == current_minor -> spsc)
+		return;
+
+	// wait for lock-free clients to leave, then for locked ones
+	percpu_down_write(&(current_minor -> spsc_sem));
+	mutex_lock(&(current_minor -> head_lock));
+	mutex_lock(&(current_minor -> tail_lock));
+	current_minor -> spsc = spsc;
+	unlock_minor(current_minor);
+	percpu_up_write(&(current_minor -> spsc_sem));
+}
+
+/*
+ * record whether the clients of the minor promise to be a single producer
+ * and a single consumer
+ */
+long request_spsc(minor_file * current_minor, int requested) {
+	if (acquire_lock(&(current_minor -> open_lock), current_minor -> minor) != 0) return -ERESTARTSYS;
+	current_minor -> spsc_requested = requested;
+	update_spsc(current_minor);
+	mutex_unlock(&(current_minor -> open_lock));
+	return 0;
+}
+
+/*
+ * release all the memory held by a minor file
+ */
+void free_minor(minor_file * current_minor) {
+	// waits for readers of the statistics file to leave
+	debugfs_remove(current_minor -> stats_file);
+	free_percpu(current_minor -> stats);
+	free_minor_segments(current_minor);
+	ring_release(rcu_dereference_protected(current_minor -> data_ring, 1));
+	percpu_free_rwsem(&(current_minor -> spsc_sem));
+	kfree_rcu(current_minor, rcu);
+}
+
+
+
+/*
+ * Segment pools
+ *
+ * A minor with preallocation enabled keeps enough free segments of its
+ * packet size class to hold its whole file size. Writers take segments from
+ * the pool and readers give them back, so a write only reaches the
+ * allocator when the pool is empty. Pools of minors without clients are
+ * returned to the system by the shrinker under memory pressure, and refill
+ * as segments are read once the minor is used again, or when the
+ * preallocation is requested again.
+ */
+
+/*
+ * take a segment for cur_size bytes from the pool, or from the caches if
+ * the pool is disabled, empty or its class is too small
+ */
+segment * take_segment(minor_file * current_minor, size_t cur_size) {
+	segment * current_segment;
+
+	current_segment = NULL;
+	if (READ_ONCE(current_minor -> pool_target) != 0) {
+		spin_lock(&(current_minor -> pool_lock));
+		if (current_minor -> pool != NULL && cur_size <= (SEGMENT_MIN_SIZE << current_minor -> pool_class)) {
+			current_segment = current_minor -> pool;
+			current_minor -> pool = current_segment -> next;
+			current_minor -> pool_count--;
+		}
+		spin_unlock(&(current_minor -> pool_lock));
+	}
+	if (!current_segment)
+		return alloc_segment(cur_size, READ_ONCE(current_minor -> queue.node));
+
+	current_segment -> segment_size = cur_size;
+	current_segment -> segment_offset = 0;
+	current_segment -> next = NULL;
+	return current_segment;
+}
+
+/*
+ * give a segment back to the pool while it is below its target, free it
+ * otherwise
+ */
+void release_segment(minor_file * current_minor, segment * current_segment) {
+	if (READ_ONCE(current_minor -> pool_target) != 0) {
+		spin_lock(&(current_minor -> pool_lock));
+		if (current_segment -> size_class == current_minor -> pool_class &&
+				(current_minor -> pool_node == NUMA_NO_NODE || current_segment -> node == current_minor -> pool_node) &&
+				current_minor -> pool_count < current_minor -> pool_target) {
+			current_segment -> next = current_minor -> pool;
+			current_minor -> pool = current_segment;
+			current_minor -> pool_count++;
+			current_segment = NULL;
+		}
+		spin_unlock(&(current_minor -> pool_lock));
+	}
+	if (current_segment)
+		free_segment(current_segment);
+}
+
+void release_segment_chain(minor_file * current_minor, segment * current_segment) {
+	pktq_release_chain(&(current_minor -> queue), current_segment);
+}
+
+/*
+ * segments of the queue core go through the pool of their minor
+ */
+segment * pktq_take_segment(pkt_queue * queue, size_t cur_size) {
+	return take_segment(container_of(queue, minor_file, queue), cur_size);
+}
+
+void pktq_release_segment(pkt_queue * queue, segment * current_segment) {
+	release_segment(container_of(queue, minor_file, queue), current_segment);
+}
+
+/*
+ * detach up to count segments from the pool, the caller frees them
+ */
+static segment * pool_detach(minor_file * current_minor, unsigned long count) {
+	segment * detached;
+	segment * current_segment;
+
+	detached = NULL;
+	while (count > 0 && current_minor -> pool != NULL) {
+		current_segment = current_minor -> pool;
+		current_minor -> pool = current_segment -> next;
+		current_minor -> pool_count--;
+		current_segment -> next = detached;
+		detached = current_segment;
+		count--;
+	}
+	return detached;
+}
+
+/*
+ * size the pool after the preallocation flag, the file size, the packet
+ * size or the engine changed; only the list engine uses segments
+ * must be called holding both minor locks, returns the segments no longer
+ * needed for the caller to free once the locks are released
+ */
+segment * pool_resize(minor_file * current_minor) {
+	segment * detached;
+	unsigned int pool_class;
+	unsigned int pool_target;
+	int pool_node;
+
+	pool_class = segment_class(current_minor -> def_segment_size);
+	pool_node = current_minor -> numa_pinned ? current_minor -> queue.node : NUMA_NO_NODE;
+	pool_target = 0;
+
+	/* large segments are allocated at the size of their packet, so they
+	 * are not pooled; their allocation is small next to their copies
+	 */
+	if (current_minor -> prealloc && current_minor -> engine == LIST && pool_class != SEGMENT_LARGE)
+		pool_target = DIV_ROUND_UP(current_minor -> file_size, current_minor -> def_segment_size) + 1;
+
+	// segments of another class, or on another node, are of no use to writers
+	spin_lock(&(current_minor -> pool_lock));
+	if (pool_class != current_minor -> pool_class || pool_node != current_minor -> pool_node)
+		detached = pool_detach(current_minor, current_minor -> pool_count);
+	else
+		detached = pool_detach(current_minor, current_minor -> pool_count - min(current_minor -> pool_count, pool_target));
+	current_minor -> pool_class = pool_class;
+	current_minor -> pool_node = pool_node;
+	WRITE_ONCE(current_minor -> pool_target, pool_target);
+	spin_unlock(&(current_minor -> pool_lock));
+	return detached;
+}
+
+/*
+ * allocate the segments the pool misses after pool_resize into a private
+ * list, then splice it into the pool; runs without the minor locks, so
+ * clients are not stalled while a large file size is reserved, and writers
+ * may take segments meanwhile
+ */
+int pool_fill(minor_file * current_minor) {
+	segment * reserved;
+	segment * last;
+	segment * current_segment;
+	unsigned int pool_class;
+	unsigned int missing;
+	unsigned int count;
+	int pool_node;
+	int ret;
+
+	spin_lock(&(current_minor -> pool_lock));
+	pool_class = current_minor -> pool_class;
+	pool_node = current_minor -> pool_node;
+	missing = current_minor -> pool_target - min(current_minor -> pool_count, current_minor -> pool_target);
+	spin_unlock(&(current_minor -> pool_lock));
+
+	reserved = NULL;
+	last = NULL;
+	ret = 0;
+	for (count = 0; count < missing; count++) {
+		current_segment = alloc_segment(SEGMENT_MIN_SIZE << pool_class, READ_ONCE(current_minor -> queue.node));
+		if (!current_segment) {
+			ret = -ENOMEM;
+			break;
+		}
+		current_segment -> next = reserved;
+		reserved = current_segment;
+		if (!last)
+			last = current_segment;
+		cond_resched();
+	}
+	if (!reserved)
+		return ret;
+
+	/* splice the whole list unless the pool was resized meanwhile, then
+	 * give back what readers refilled beyond the target
+	 */
+	spin_lock(&(current_minor -> pool_lock));
+	if (pool_class == current_minor -> pool_class && pool_node == current_minor -> pool_node) {
+		last -> next = current_minor -> pool;
+		current_minor -> pool = reserved;
+		current_minor -> pool_count += count;
+		reserved = pool_detach(current_minor, current_minor -> pool_count - min(current_minor -> pool_count, current_minor -> pool_target));
+	}
+	spin_unlock(&(current_minor -> pool_lock));
+	free_segment_chain(reserved);
+	return ret;
+}
+
+/*
+ * segments held by the pools of minors without clients
+ */
+static unsigned long pool_shrink_count(struct shrinker * shrinker, struct shrink_control * sc) {
+	minor_file * current_minor;
+	unsigned long count;
+	unsigned long minor;
+
+	count = 0;
+	rcu_read_lock();
+	xa_for_each(&minor_files, minor, current_minor) {
+		if (READ_ONCE(current_minor -> clients) == 0)
+			count += READ_ONCE(current_minor -> pool_count);
+	}
+	rcu_read_unlock();
+	return count ? count : SHRINK_EMPTY;
+}
+
+/*
+ * free pooled segments of minors without clients; the minor memory stays
+ * valid under rcu_read_lock and its pool is only touched under pool_lock
+ */
+static unsigned long pool_shrink_scan(struct shrinker * shrinker, struct shrink_control * sc) {
+	minor_file * current_minor;
+	segment * detached;
+	unsigned long freed;
+	unsigned long before;
+	unsigned long minor;
+
+	freed = 0;
+	rcu_read_lock();
+	xa_for_each(&minor_files, minor, current_minor) {
+		if (freed >= sc -> nr_to_scan) break;
+		if (READ_ONCE(current_minor -> clients) != 0)
+			continue;
+
+		spin_lock(&(current_minor -> pool_lock));
+		before = current_minor -> pool_count;
+		detached = pool_detach(current_minor, sc -> nr_to_scan - freed);
+		freed += before - current_minor -> pool_count;
+		spin_unlock(&(current_minor -> pool_lock));
+		free_segment_chain(detached);
+	}
+	rcu_read_unlock();
+	return freed ? freed : SHRINK_STOP;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker * pool_shrinker;
+
+int register_pool_shrinker(void) {
+	pool_shrinker = shrinker_alloc(0, "pktstrm-pool");
+	if (!pool_shrinker)
+		return -ENOMEM;
+	pool_shrinker -> count_objects = pool_shrink_count;
+	pool_shrinker -> scan_objects = pool_shrink_scan;
+	shrinker_register(pool_shrinker);
+	return 0;
+}
+
+void unregister_pool_shrinker(void) {
+	shrinker_free(pool_shrinker);
+}
+#else
+static struct shrinker pool_shrinker = {
+	.count_objects = pool_shrink_count,
+	.scan_objects = pool_shrink_scan,
+	.seeks = DEFAULT_SEEKS
+};
+
+int register_pool_shrinker(void) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	return register_shrinker(&pool_shrinker, "pktstrm-pool");
+#else
+	return register_shrinker(&pool_shrinker);
+#endif
+}
+
+void unregister_pool_shrinker(void) {
+	unregister_shrinker(&pool_shrinker);
+}
+#endif
+
+
+
+/*
+ * Ring storage engine
+ *
+ * Data is kept in a byte ring whose size is a power of two, packet boundaries
+ * in a second ring of lengths. Any read or write touches at most two
+ * contiguous regions of the byte ring.
+ *
+ * Control page, lengths and bytes are a single vmalloc_user area that can be
+ * mapped by clients. Indices in the control page may be written by user space
+ * producers and consumers, so they are never trusted to stay within the ring
+ * geometry, which is only taken from the kernel private fields.
+ */
+
+/*
+ * allocate empty rings able to hold file_size bytes
+ */
+ring * ring_alloc(size_t file_size) {
+	ring * data_ring;
+	size_t lengths_offset;
+	size_t data_offset;
+
+	data_ring = kzalloc(sizeof(ring), GFP_KERNEL);
+	if (!data_ring)
+		return NULL;
+	data_ring -> data_size = max_t(size_t, roundup_pow_of_two(file_size), PAGE_SIZE);
+	data_ring -> pkt_slots = data_ring -> data_size / SEGMENT_MIN_SIZE;
+
+	// control page, then lengths, then bytes, each page aligned
+	lengths_offset = PAGE_SIZE;
+	data_offset = lengths_offset + PAGE_ALIGN(data_ring -> pkt_slots * sizeof(unsigned int));
+	data_ring -> map_size = data_offset + data_ring -> data_size;
+
+	data_ring -> ctrl = vmalloc_user(data_ring -> map_size);
+	if (!data_ring -> ctrl) {
+		kfree(data_ring);
+		return NULL;
+	}
+	data_ring -> lengths = (unsigned int *) ((byte *) data_ring -> ctrl + lengths_offset);
+	data_ring -> data = (byte *) data_ring -> ctrl + data_offset;
+
+	// geometry published to clients mapping the ring
+	data_ring -> ctrl -> data_size = data_ring -> data_size;
+	data_ring -> ctrl -> pkt_slots = data_ring -> pkt_slots;
+	data_ring -> ctrl -> capacity = file_size;
+	data_ring -> ctrl -> lengths_offset = lengths_offset;
+	data_ring -> ctrl -> data_offset = data_offset;
+	return data_ring;
+}
+
+/*
+ * free ring storage no reader can reach anymore, safe on NULL
+ */
+void ring_release(ring * data_ring) {
+	if (!data_ring)
+		return;
+	vfree(data_ring -> ctrl);
+	kfree(data_ring);
+}
+
+static void ring_release_rcu(struct rcu_head * rcu) {
+	ring_release(container_of(rcu, ring, rcu));
+}
+
+/*
+ * free ring storage unpublished from its minor once lockless readers left
+ */
+void ring_release_deferred(ring * data_ring) {
+	if (data_ring)
+		call_rcu(&(data_ring -> rcu), ring_release_rcu);
+}
+
+/*
+ * ring storage of the minor, NULL with the list engine
+ * must be called holding a side of the queue, or under rcu_read_lock
+ */
+ring * minor_ring(minor_file * current_minor) {
+	return rcu_dereference_check(current_minor -> data_ring,
+		lockdep_is_held(&(current_minor -> head_lock)) || lockdep_is_held(&(current_minor -> tail_lock)) ||
+		percpu_rwsem_is_held(&(current_minor -> spsc_sem)));
+}
+
+/*
+ * move the queued bytes and boundaries into rings sized for file_size
+ * a mapped ring can only change its capacity within the current storage
+ */
+int ring_resize(minor_file * current_minor, size_t file_size) {
+	ring * data_ring;
+	ring * new_ring;
+	unsigned int queued;
+	unsigned int pkts;
+	unsigned int i;
+	size_t pos;
+	size_t first;
+
+	data_ring = minor_ring(current_minor);
+	if (max_t(size_t, roundup_pow_of_two(file_size), PAGE_SIZE) == data_ring -> data_size) {
+		data_ring -> ctrl -> capacity = file_size;
+		return 0;
+	}
+	if (atomic_read(&(current_minor -> ring_mappings)) != 0)
+		return -EBUSY;
+	new_ring = ring_alloc(file_size);
+	if (!new_ring)
+		return -ENOMEM;
+
+	queued = min_t(unsigned int, ring_queued(data_ring), data_ring -> data_size);
+	pkts = min_t(unsigned int, data_ring -> ctrl -> pkt_head - data_ring -> ctrl -> pkt_tail, data_ring -> pkt_slots);
+	if (pkts > new_ring -> pkt_slots) {
+		ring_release(new_ring);
+		return -ENOSPC;
+	}
+
+	// linearize queued bytes at the start of the new ring
+	pos = data_ring -> ctrl -> tail & (data_ring -> data_size - 1);
+	first = min_t(size_t, queued, data_ring -> data_size - pos);
+	memcpy(new_ring -> data, data_ring -> data + pos, first);
+	memcpy(new_ring -> data + first, data_ring -> data, queued - first);
+	new_ring -> ctrl -> head = queued;
+
+	for (i = 0; i < pkts; i++)
+		new_ring -> lengths[i] = data_ring -> lengths[(data_ring -> ctrl -> pkt_tail + i) & (data_ring -> pkt_slots - 1)];
+	new_ring -> ctrl -> pkt_head = pkts;
+
+	// lockless readers may still look at the old indices
+	rcu_assign_pointer(current_minor -> data_ring, new_ring);
+	ring_release_deferred(data_ring);
+	sync_ring_waiters(current_minor);
+	return 0;
+}
+
+/*
+ * bytes published and not yet consumed, bounded by the ring size
+ */
+unsigned int ring_queued(ring * data_ring) {
+	unsigned int queued;
+
+	queued = smp_load_acquire(&(data_ring -> ctrl -> head)) - smp_load_acquire(&(data_ring -> ctrl -> tail));
+	return min_t(unsigned int, queued, data_ring -> data_size);
+}
+
+/*
+ * copy count bytes from the ring starting at offset, at most two copies
+ */
+static unsigned long ring_copy_out(ring * data_ring, unsigned int offset, struct iov_iter * to, size_t count) {
+	size_t pos;
+	size_t first;
+
+	pos = offset & (data_ring -> data_size - 1);
+	first = min(count, data_ring -> data_size - pos);
+	if (copy_to_iter(data_ring -> data + pos, first, to) != first)
+		return count;
+	return count - first - copy_to_iter(data_ring -> data, count - first, to);
+}
+
+/*
+ * copy count bytes into the ring starting at offset, at most two copies
+ */
+static unsigned long ring_copy_in(ring * data_ring, unsigned int offset, struct iov_iter * from, size_t count) {
+	size_t pos;
+	size_t first;
+
+	pos = offset & (data_ring -> data_size - 1);
+	first = min(count, data_ring -> data_size - pos);
+	if (copy_from_iter(data_ring -> data + pos, first, from) != first)
+		return count;
+	return count - first - copy_from_iter(data_ring -> data, count - first, from);
+}
+
+/*
+ * append a write to the ring, split in packets of default segment size
+ * the space was checked by the caller, which is the only producer
+ */
+size_t ring_append(minor_file * current_minor, size_t count, struct iov_iter * from) {
+	ring * data_ring;
+	size_t pkt_size;
+	size_t written;
+	unsigned int head;
+	unsigned int pkt_head;
+
+	data_ring = minor_ring(current_minor);
+	head = data_ring -> ctrl -> head;
+	if (ring_copy_in(data_ring, head, from, count) != 0) {
+		pr_debug("%s: could not copy ring data from user\n", DEVICE_NAME);
+		return 0;
+	}
+
+	pkt_head = data_ring -> ctrl -> pkt_head;
+	for (written = 0; written < count; written += pkt_size) {
+		pkt_size = min(count - written, current_minor -> def_segment_size);
+		data_ring -> lengths[pkt_head & (data_ring -> pkt_slots - 1)] = pkt_size;
+		pkt_head++;
+	}
+
+	/* publish boundaries before bytes: a reader observing the new head
+	 * also observes the packets covering it
+	 */
+	smp_store_release(&(data_ring -> ctrl -> pkt_head), pkt_head);
+	smp_store_release(&(data_ring -> ctrl -> head), head + count);
+	return count;
+}
+
+/*
+ * pop a single packet, bytes not fitting in the buffer are discarded
+ */
+ssize_t ring_read_packet(minor_file * current_minor, struct iov_iter * to, size_t count) {
+	ring * data_ring;
+	size_t pkt_size;
+	size_t to_read;
+	unsigned int tail;
+
+	// has_data observed the packet, its boundary and bytes are visible
+	data_ring = minor_ring(current_minor);
+	tail = data_ring -> ctrl -> tail;
+	pkt_size = data_ring -> lengths[data_ring -> ctrl -> pkt_tail & (data_ring -> pkt_slots - 1)];
+	pkt_size = min_t(size_t, pkt_size, ring_queued(data_ring));
+	to_read = min(count, pkt_size);
+	if (ring_copy_out(data_ring, tail, to, to_read) != 0)
+		return -EFAULT;
+
+	smp_store_release(&(data_ring -> ctrl -> tail), tail + pkt_size);
+	smp_store_release(&(data_ring -> ctrl -> pkt_tail), data_ring -> ctrl -> pkt_tail + 1);
+	minor_stat_add(current_minor, pkts_out, 1);
+	if (to_read < pkt_size) {
+		minor_stat_add(current_minor, bytes_dropped, pkt_size - to_read);
+		trace_pktstrm_drop(current_minor -> minor, pkt_size - to_read);
+	}
+	return to_read;
+}
+
+/*
+ * discard the packet at the tail of the ring without reading it, returns
+ * its size
+ */
+size_t ring_drop_packet(minor_file * current_minor) {
+	ring * data_ring;
+	size_t pkt_size;
+
+	data_ring = minor_ring(current_minor);
+	pkt_size = data_ring -> lengths[data_ring -> ctrl -> pkt_tail & (data_ring -> pkt_slots - 1)];
+	pkt_size = min_t(size_t, pkt_size, ring_queued(data_ring));
+
+	smp_store_release(&(data_ring -> ctrl -> tail), data_ring -> ctrl -> tail + pkt_size);
+	smp_store_release(&(data_ring -> ctrl -> pkt_tail), data_ring -> ctrl -> pkt_tail + 1);
+	return pkt_size;
+}
+
+/*
+ * read up to count bytes across packets, a partially read packet keeps
+ * its residual as an independent packet; the boundaries come from the
+ * shared control page, the walk is bounded by the slots of the ring and
+ * boundaries not covering the bytes read are reported as -EIO
+ */
+ssize_t ring_read_stream(minor_file * current_minor, struct iov_iter * to, size_t count) {
+	ring * data_ring;
+	unsigned int * pkt_size;
+	size_t to_read;
+	size_t consumed;
+	unsigned int tail;
+	unsigned int pkt_tail;
+	unsigned int pkts;
+
+	// only published bytes can be read
+	data_ring = minor_ring(current_minor);
+	tail = data_ring -> ctrl -> tail;
+	to_read = min_t(size_t, count, ring_queued(data_ring));
+	if (ring_copy_out(data_ring, tail, to, to_read) != 0)
+		return -EFAULT;
+
+	// pop fully read packets and shrink the one read in part
+	consumed = to_read;
+	pkt_tail = data_ring -> ctrl -> pkt_tail;
+	pkts = min_t(unsigned int, smp_load_acquire(&(data_ring -> ctrl -> pkt_head)) - pkt_tail, data_ring -> pkt_slots);
+	for (; consumed > 0 && pkts > 0; pkts--) {
+		pkt_size = &(data_ring -> lengths[pkt_tail & (data_ring -> pkt_slots - 1)]);
+		if (*pkt_size == 0 || *pkt_size > data_ring -> data_size)
+			break;
+		if (*pkt_size > consumed) {
+			*pkt_size -= consumed;
+			minor_stat_add(current_minor, splits, 1);
+			trace_pktstrm_split(current_minor -> minor, consumed, *pkt_size);
+			consumed = 0;
+			break;
+		}
+		consumed -= *pkt_size;
+		pkt_tail++;
+	}
+	if (consumed > 0) {
+		pr_debug("%s: corrupted packet boundaries in the ring of minor %d\n", DEVICE_NAME, current_minor -> minor);
+		return -EIO;
+	}
+
+	minor_stat_add(current_minor, pkts_out, pkt_tail - data_ring -> ctrl -> pkt_tail);
+	smp_store_release(&(data_ring -> ctrl -> tail), tail + to_read);
+	smp_store_release(&(data_ring -> ctrl -> pkt_tail), pkt_tail);
+	return to_read;
+}
+
+/*
+ * mirror the number of sleeping readers and writers in the control page,
+ * user space producers and consumers notify the device only when non zero
+ */
+void sync_ring_waiters(minor_file * current_minor) {
+	ring * data_ring;
+
+	spin_lock(&(current_minor -> waiters_lock));
+	rcu_read_lock();
+	data_ring = rcu_dereference(current_minor -> data_ring);
+	if (data_ring) {
+		WRITE_ONCE(data_ring -> ctrl -> read_waiters, current_minor -> read_waiters);
+		WRITE_ONCE(data_ring -> ctrl -> write_waiters, current_minor -> write_waiters);
+	}
+	rcu_read_unlock();
+	spin_unlock(&(current_minor -> waiters_lock));
+}
+
+static void add_waiter(minor_file * current_minor, unsigned int * waiters, int delta) {
+	spin_lock(&(current_minor -> waiters_lock));
+	*waiters += delta;
+	spin_unlock(&(current_minor -> waiters_lock));
+	sync_ring_waiters(current_minor);
+	smp_mb();
+}
+
+/*
+ * sleep until data reaches the read low watermark, or space for count bytes
+ * is available; readers share a condition, so they wait exclusively and
+ * are woken one at a time, while writers wait for their own part size and
+ * lane and are all woken to check it
+ * the sleep is advertised to clients producing or consuming in place
+ */
+int wait_for_data(minor_file * current_minor) {
+	u64 start;
+	int ret;
+
+	add_waiter(current_minor, &(current_minor -> read_waiters), 1);
+	trace_pktstrm_block(current_minor -> minor, false, 0);
+	start = ktime_get_ns();
+	ret = wait_event_interruptible_exclusive(current_minor -> read_queue, above_read_lowat(current_minor));
+	minor_stat_add(current_minor, blocked_reads, 1);
+	minor_stat_add(current_minor, read_wait_ns, ktime_get_ns() - start);
+	trace_pktstrm_wakeup(current_minor -> minor, false, ret != 0);
+	add_waiter(current_minor, &(current_minor -> read_waiters), -1);
+	return ret;
+}
+
+int wait_for_space(minor_file * current_minor, unsigned int lane, size_t count) {
+	u64 start;
+	int ret;
+
+	add_waiter(current_minor, &(current_minor -> write_waiters), 1);
+	trace_pktstrm_block(current_minor -> minor, true, count);
+	start = ktime_get_ns();
+	ret = wait_event_interruptible(current_minor -> write_queue,
+		lane_has_space(current_minor, lane, count) || READ_ONCE(current_minor -> overflow) != OVERFLOW_BLOCK);
+	minor_stat_add(current_minor, blocked_writes, 1);
+	minor_stat_add(current_minor, write_wait_ns, ktime_get_ns() - start);
+	trace_pktstrm_wakeup(current_minor -> minor, true, ret != 0);
+	add_waiter(current_minor, &(current_minor -> write_waiters), -1);
+	return ret;
+}
+
+/*
+ * track the mappings of a ring, the storage cannot move while mapped
+ */
+static void pktstream_vm_open(struct vm_area_struct * vma) {
+	minor_file * current_minor = vma -> vm_private_data;
+
+	atomic_inc(&(current_minor -> ring_mappings));
+}
+
+static void pktstream_vm_close(struct vm_area_struct * vma) {
+	minor_file * current_minor = vma -> vm_private_data;
+
+	atomic_dec(&(current_minor -> ring_mappings));
+}
+
+static const struct vm_operations_struct pktstream_vm_ops = {
+	.open = pktstream_vm_open,
+	.close = pktstream_vm_close
+};
+
+/*
+ * map control page, lengths and bytes of the ring engine storage
+ */
+int pktstream_mmap(struct file *file_p, struct vm_area_struct *vma) {
+	minor_file * current_minor;
+	int minor;
+	int ret;
+
+	current_minor = retrieve_minor(file_p, "mmap");
+	minor = current_minor -> minor;
+
+	// storage is only reshaped holding both locks
+	if (lock_minor(current_minor, minor) != 0) return -ERESTARTSYS;
+
+	// private mappings would not see the indices moved by the other side
+	if (current_minor -> engine != RING || !(vma -> vm_flags & VM_SHARED)) {
+		unlock_minor(current_minor);
+		printk(KERN_ALERT "%s: invalid mmap on minor %d, needs a shared mapping of the ring engine\n", DEVICE_NAME, minor);
+		return -EINVAL;
+	}
+
+	ret = remap_vmalloc_range(vma, minor_ring(current_minor) -> ctrl, vma -> vm_pgoff);
+	if (ret == 0) {
+		vma -> vm_ops = &pktstream_vm_ops;
+		vma -> vm_private_data = current_minor;
+		pktstream_vm_open(vma);
+	}
+
+	unlock_minor(current_minor);
+	return ret;
+}
+
+
+
+/*
+ * IOCTL function
+ */
+
+long pktstream_ioctl(struct file *file_p, unsigned int ioctl_cmd, unsigned long ioctl_arg){
+	minor_file * current_minor;
+	session * current_session;
+	int minor;
+	int reshape;
+	int node;
+	int refill;
+	pktstrm_lane_reserve reserve;
+	segment * detached;
+	long ret;
+
+	// variables initialization
+	current_session = retrieve_session(file_p, "ioctl");
+	current_minor = current_session -> current_minor;
+	minor = current_minor -> minor;
+	refill = 0;
+	ret = 0;
+
+	// modes belong to the session, no lock of the minor is needed
+	switch(ioctl_cmd) {
+
+	// set current operative mode to packet
+	case PKTSTRM_IOCTL_SET_MODE_PACKET:
+		current_session -> op_mode = PACKET;
+		return 0;
+
+	// set current operative mode to stream
+	case PKTSTRM_IOCTL_SET_MODE_STREAM:
+		current_session -> op_mode = STREAM;
+		return 0;
+
+	// set current access mode to blocking
+	case PKTSTRM_IOCTL_SET_ACC_BLOCK:
+		current_session -> ac_mode = BLOCK;
+		return 0;
+
+	// set current access mode to non-blocking
+	case PKTSTRM_IOCTL_SET_ACC_NO_BLOCK:
+		current_session -> ac_mode = NON_BLOCK;
+		return 0;
+
+	// set the priority lane of the following writes
+	case PKTSTRM_IOCTL_SET_LANE:
+		if (ioctl_arg >= PKTSTRM_LANES) {
+			printk(KERN_ALERT "%s: ioctl invalid lane %lu\n", DEVICE_NAME, ioctl_arg);
+			return -1;
+		}
+		current_session -> lane = ioctl_arg;
+		return 0;
+	}
+
+	// toggling the fast path is serialized with open and release
+	if (ioctl_cmd == PKTSTRM_IOCTL_SET_SPSC)
+		return request_spsc(current_minor, ioctl_arg != 0);
+
+	// broadcast mode changes the fast path and the subscriber cursors
+	if (ioctl_cmd == PKTSTRM_IOCTL_SET_BROADCAST)
+		return request_broadcast(current_minor, ioctl_arg != 0);
+
+	// the overflow policy changes the fast path, like broadcast mode
+	if (ioctl_cmd == PKTSTRM_IOCTL_SET_OVERFLOW)
+		return request_overflow(current_minor, ioctl_arg);
+
+	// drops are counted apart from the queue
+	if (ioctl_cmd == PKTSTRM_IOCTL_GET_DROPS)
+		return report_drops(current_minor, (pktstrm_drops *) ioctl_arg);
+
+	// batched reads only need the head of the queue
+	if (ioctl_cmd == PKTSTRM_IOCTL_READ_BATCH)
+		return pktstream_read_batch(current_session, (pktstrm_batch *) ioctl_arg);
+
+	// clients of a mapped ring sleep without holding any lock
+	if (ioctl_cmd == PKTSTRM_IOCTL_RING_WAIT_DATA)
+		return wait_for_data(current_minor) ? -ERESTARTSYS : 0;
+	if (ioctl_cmd == PKTSTRM_IOCTL_RING_WAIT_SPACE) {
+		if (ioctl_arg == 0 || ioctl_arg > current_minor -> file_size) return -EINVAL;
+		return wait_for_space(current_minor, 0, ioctl_arg) ? -ERESTARTSYS : 0;
+	}
+
+	// changes to the storage, or to the sizes a write is split by, must
+	// also wait for lock-free clients
+	reshape = ioctl_cmd == PKTSTRM_IOCTL_SET_FILE_SIZE ||
+		ioctl_cmd == PKTSTRM_IOCTL_SET_ENGINE_LIST || ioctl_cmd == PKTSTRM_IOCTL_SET_ENGINE_RING ||
+		ioctl_cmd == PKTSTRM_IOCTL_SET_PKT_SIZE || ioctl_cmd == PKTSTRM_IOCTL_SET_ATOMIC_SIZE;
+	if (reshape)
+		percpu_down_write(&(current_minor -> spsc_sem));
+
+	// acquire both locks, settings are read by readers and writers
+	if (lock_minor(current_minor, minor) != 0) {
+		if (reshape) percpu_up_write(&(current_minor -> spsc_sem));
+		return -ERESTARTSYS;
+	}
+
+	switch(ioctl_cmd) {
+
+	// set segment size to passed argument
+	case PKTSTRM_IOCTL_SET_PKT_SIZE:
+		if (!pktq_valid_pkt_size(ioctl_arg)) {
+			printk(KERN_ALERT "%s: ioctl invalid packet size %zd\n", DEVICE_NAME, ioctl_arg);
+			ret = -1;
+			break;
+		}
+		current_minor -> def_segment_size = ioctl_arg;
+		refill = 1;
+		break;
+
+	// set file size to passed argument
+	case PKTSTRM_IOCTL_SET_FILE_SIZE:
+		if (!pktq_valid_file_size(ioctl_arg, queued_bytes(current_minor)) ||
+				ioctl_arg < reserved_bytes(current_minor, PKTSTRM_LANES)) {
+			printk(KERN_ALERT "%s: ioctl invalid file size %zd\n", DEVICE_NAME, ioctl_arg);
+			ret = -1;
+			break;
+		}
+		if (current_minor -> engine == RING && ring_resize(current_minor, ioctl_arg) != 0) {
+			printk(KERN_ALERT "%s: ioctl could not resize ring to %zd\n", DEVICE_NAME, ioctl_arg);
+			ret = -1;
+			break;
+		}
+		current_minor -> file_size = ioctl_arg;
+		current_minor -> read_lowat = min(current_minor -> read_lowat, ioctl_arg);
+		current_minor -> write_lowat = min(current_minor -> write_lowat, ioctl_arg);
+		current_minor -> atomic_size = min(current_minor -> atomic_size, ioctl_arg);
+		refill = 1;
+		break;
+
+	// reserve segments for the whole file size, or give them back
+	case PKTSTRM_IOCTL_SET_PREALLOC:
+		current_minor -> prealloc = ioctl_arg != 0;
+		refill = 1;
+		break;
+
+	// set storage engine to linked list of segments
+	case PKTSTRM_IOCTL_SET_ENGINE_LIST:
+		if (set_storage_engine(current_minor, LIST) != 0) {
+			printk(KERN_ALERT "%s: ioctl could not switch minor %d to list engine\n", DEVICE_NAME, minor);
+			ret = -1;
+		} else {
+			refill = 1;
+		}
+		break;
+
+	// set storage engine to byte ring
+	case PKTSTRM_IOCTL_SET_ENGINE_RING:
+		if (current_minor -> broadcast || set_storage_engine(current_minor, RING) != 0) {
+			printk(KERN_ALERT "%s: ioctl could not switch minor %d to ring engine\n", DEVICE_NAME, minor);
+			ret = -1;
+		} else {
+			// the ring storage needs no segments
+			refill = 1;
+		}
+		break;
+
+	// wake up sleepers after producing or consuming in place
+	case PKTSTRM_IOCTL_RING_NOTIFY:
+		wake_readers(current_minor);
+		wake_writers(current_minor);
+		break;
+
+	// set the bytes that must be queued before a blocked reader is woken
+	case PKTSTRM_IOCTL_SET_READ_LOWAT:
+		if (ioctl_arg == 0 || ioctl_arg > current_minor -> file_size) {
+			printk(KERN_ALERT "%s: ioctl invalid read low watermark %zd\n", DEVICE_NAME, ioctl_arg);
+			ret = -1;
+			break;
+		}
+		current_minor -> read_lowat = ioctl_arg;
+		break;
+
+	// set the free bytes needed before a blocked writer is woken
+	case PKTSTRM_IOCTL_SET_WRITE_LOWAT:
+		if (ioctl_arg == 0 || ioctl_arg > current_minor -> file_size) {
+			printk(KERN_ALERT "%s: ioctl invalid write low watermark %zd\n", DEVICE_NAME, ioctl_arg);
+			ret = -1;
+			break;
+		}
+		current_minor -> write_lowat = ioctl_arg;
+		break;
+
+	// pin segments to a memory node, or let them follow the reader
+	case PKTSTRM_IOCTL_SET_NUMA_NODE:
+		node = (int) ioctl_arg;
+		if (node != PKTSTRM_NUMA_FOLLOW && (node < 0 || node >= nr_node_ids || !node_online(node))) {
+			printk(KERN_ALERT "%s: ioctl invalid memory node %d\n", DEVICE_NAME, node);
+			ret = -1;
+			break;
+		}
+		WRITE_ONCE(current_minor -> numa_pinned, node != PKTSTRM_NUMA_FOLLOW);
+		if (node != PKTSTRM_NUMA_FOLLOW)
+			WRITE_ONCE(current_minor -> queue.node, node);
+		refill = 1;
+		break;
+
+	// reserve part of the file size to the data of a lane
+	case PKTSTRM_IOCTL_SET_LANE_RESERVE:
+		if (copy_from_user(&reserve, (pktstrm_lane_reserve *) ioctl_arg, sizeof(pktstrm_lane_reserve)) != 0) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reserve.lane >= PKTSTRM_LANES || reserve.bytes + reserved_bytes(current_minor, reserve.lane) > current_minor -> file_size) {
+			printk(KERN_ALERT "%s: ioctl invalid lane reservation of %zd bytes\n", DEVICE_NAME, reserve.bytes);
+			ret = -1;
+			break;
+		}
+		current_minor -> lane_reserve[reserve.lane] = reserve.bytes;
+		wake_writers(current_minor);
+		break;
+
+	// set the largest write queued whole or not at all
+	case PKTSTRM_IOCTL_SET_ATOMIC_SIZE:
+		if (ioctl_arg == 0 || ioctl_arg > current_minor -> file_size) {
+			printk(KERN_ALERT "%s: ioctl invalid atomic size %zd\n", DEVICE_NAME, ioctl_arg);
+			ret = -1;
+			break;
+		}
+		WRITE_ONCE(current_minor -> atomic_size, ioctl_arg);
+		break;
+	}
+
+	// the pool is sized under the locks and filled without them
+	detached = refill ? pool_resize(current_minor) : NULL;
+	unlock_minor(current_minor);
+	if (reshape)
+		percpu_up_write(&(current_minor -> spsc_sem));
+	free_segment_chain(detached);
+	if (refill && pool_fill(current_minor) != 0) {
+		printk(KERN_ALERT "%s: ioctl could not fill pool of minor %d\n", DEVICE_NAME, minor);
+
+		// a failed preallocation gives back what it reserved
+		if (ioctl_cmd == PKTSTRM_IOCTL_SET_PREALLOC) {
+			if (lock_minor(current_minor, minor) == 0) {
+				current_minor -> prealloc = 0;
+				detached = pool_resize(current_minor);
+				unlock_minor(current_minor);
+				free_segment_chain(detached);
+			}
+			ret = -ENOMEM;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,213 @@
+#ifndef PKTSTREAM_SHIM_H
+#define PKTSTREAM_SHIM_H
+
+/*
+ * Services the queue core needs from its environment: allocation of
+ * segments, copies from and to the buffers of clients, locks and waits.
+ * In the module they map to the kernel primitives, in user space to libc
+ * and pthreads, so the core can be built and measured without the module.
+ */
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/topology.h>
+
+// memory nodes, allocations prefer the given node or the local one with
+// NUMA_NO_NODE
+#define shim_node_id() numa_node_id()
+#define shim_cacheline_aligned ____cacheline_aligned_in_smp
+
+// caches of objects of a fixed size
+typedef struct kmem_cache shim_cache;
+#define shim_cache_create(name, size) kmem_cache_create(name, size, 0, SLAB_HWCACHE_ALIGN, NULL)
+#define shim_cache_destroy(cache) kmem_cache_destroy(cache)
+#define shim_cache_alloc(cache, node) kmem_cache_alloc_node(cache, GFP_KERNEL, node)
+#define shim_cache_free(cache, obj) kmem_cache_free(cache, obj)
+
+// objects too large for the caches, not necessarily physically contiguous
+#define shim_large_alloc(size, node) kvmalloc_node(size, GFP_KERNEL, node)
+#define shim_large_free(obj) kvfree(obj)
+
+// buffers of clients, copies return the number of bytes copied
+typedef struct iov_iter shim_iter;
+#define shim_copy_from(dst, bytes, iter) copy_from_iter(dst, bytes, iter)
+#define shim_copy_to(src, bytes, iter) copy_to_iter(src, bytes, iter)
+#define shim_iter_count(iter) iov_iter_count(iter)
+
+// sleeping locks
+typedef struct mutex shim_mutex;
+#define shim_mutex_init(lock) mutex_init(lock)
+#define shim_mutex_lock(lock) mutex_lock(lock)
+#define shim_mutex_unlock(lock) mutex_unlock(lock)
+
+// wait queues, a wait returns non zero if interrupted
+typedef wait_queue_head_t shim_waitq;
+#define shim_waitq_init(wq) init_waitqueue_head(wq)
+#define shim_wait_event(wq, condition) wait_event_interruptible(*(wq), condition)
+#define shim_waitq_active(wq) wq_has_sleeper(wq)
+#define shim_wake_up(wq) wake_up_interruptible(wq)
+#define shim_wake_up_all(wq) wake_up_interruptible_all(wq)
+
+#else
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+// kernel helpers used by the core
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), val, __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, val) __atomic_store_n(p, val, __ATOMIC_RELEASE)
+#define smp_mb__before_atomic() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+// a single memory node
+#define NUMA_NO_NODE (-1)
+#define shim_node_id() 0
+#define shim_cacheline_aligned __attribute__((aligned(64)))
+
+typedef struct {
+	long counter;
+} atomic_long_t;
+
+static inline long atomic_long_read(atomic_long_t * v) {
+	return __atomic_load_n(&(v -> counter), __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_set(atomic_long_t * v, long i) {
+	__atomic_store_n(&(v -> counter), i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_add(long i, atomic_long_t * v) {
+	__atomic_fetch_add(&(v -> counter), i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_sub(long i, atomic_long_t * v) {
+	__atomic_fetch_sub(&(v -> counter), i, __ATOMIC_RELAXED);
+}
+
+// caches of objects of a fixed size, served by malloc
+typedef struct shim_cache {
+	size_t size;
+} shim_cache;
+
+static inline shim_cache * shim_cache_create(const char * name, size_t size) {
+	shim_cache * cache;
+
+	cache = malloc(sizeof(shim_cache));
+	if (cache) cache -> size = size;
+	return cache;
+}
+
+static inline void shim_cache_destroy(shim_cache * cache) {
+	free(cache);
+}
+
+static inline void * shim_cache_alloc(shim_cache * cache, int node) {
+	return malloc(cache -> size);
+}
+
+static inline void shim_cache_free(shim_cache * cache, void * obj) {
+	free(obj);
+}
+
+// objects too large for the caches
+#define shim_large_alloc(size, node) malloc(size)
+#define shim_large_free(obj) free(obj)
+
+// a single flat buffer, consumed as bytes are copied
+typedef struct shim_iter {
+	unsigned char * base;
+	size_t count;
+} shim_iter;
+
+static inline void shim_iter_init(shim_iter * iter, void * base, size_t count) {
+	iter -> base = base;
+	iter -> count = count;
+}
+
+static inline size_t shim_copy_from(void * dst, size_t bytes, shim_iter * iter) {
+	bytes = min(bytes, iter -> count);
+	memcpy(dst, iter -> base, bytes);
+	iter -> base += bytes;
+	iter -> count -= bytes;
+	return bytes;
+}
+
+static inline size_t shim_copy_to(const void * src, size_t bytes, shim_iter * iter) {
+	bytes = min(bytes, iter -> count);
+	memcpy(iter -> base, src, bytes);
+	iter -> base += bytes;
+	iter -> count -= bytes;
+	return bytes;
+}
+
+#define shim_iter_count(iter) ((iter) -> count)
+
+// sleeping locks
+typedef pthread_mutex_t shim_mutex;
+#define shim_mutex_init(lock) pthread_mutex_init(lock, NULL)
+#define shim_mutex_lock(lock) pthread_mutex_lock(lock)
+#define shim_mutex_unlock(lock) pthread_mutex_unlock(lock)
+
+/* wait queues: the condition is checked under the lock of the queue and
+ * wakers take the same lock, so a wake-up between the check and the sleep
+ * is not lost; wakers skip the lock while nobody sleeps, like the module
+ * does with wq_has_sleeper; waits are never interrupted
+ */
+typedef struct shim_waitq {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int sleepers;
+} shim_waitq;
+
+static inline void shim_waitq_init(shim_waitq * wq) {
+	pthread_mutex_init(&(wq -> lock), NULL);
+	pthread_cond_init(&(wq -> cond), NULL);
+	wq -> sleepers = 0;
+}
+
+#define shim_wait_event(wq, condition) ({ \
+	pthread_mutex_lock(&((wq) -> lock)); \
+	__atomic_add_fetch(&((wq) -> sleepers), 1, __ATOMIC_SEQ_CST); \
+	while (!(condition)) \
+		pthread_cond_wait(&((wq) -> cond), &((wq) -> lock)); \
+	__atomic_sub_fetch(&((wq) -> sleepers), 1, __ATOMIC_SEQ_CST); \
+	pthread_mutex_unlock(&((wq) -> lock)); \
+	0; \
+})
+
+static inline int shim_waitq_active(shim_waitq * wq) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&(wq -> sleepers), __ATOMIC_RELAXED) != 0;
+}
+
+static inline void shim_wake_up(shim_waitq * wq) {
+	if (!shim_waitq_active(wq))
+		return;
+	pthread_mutex_lock(&(wq -> lock));
+	pthread_cond_signal(&(wq -> cond));
+	pthread_mutex_unlock(&(wq -> lock));
+}
+
+static inline void shim_wake_up_all(shim_waitq * wq) {
+	pthread_mutex_lock(&(wq -> lock));
+	pthread_cond_broadcast(&(wq -> cond));
+	pthread_mutex_unlock(&(wq -> lock));
+}
+
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pktstrm
+
+#if !defined(PKTSTREAM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PKTSTREAM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Data movement events: bytes added to or removed from a minor, with the
+ * amount queued afterwards
+ */
+
+DECLARE_EVENT_CLASS(pktstrm_data,
+
+	TP_PROTO(int minor, size_t bytes, size_t queued),
+
+	TP_ARGS(minor, bytes, queued),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(size_t, bytes)
+		__field(size_t, queued)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->bytes = bytes;
+		__entry->queued = queued;
+	),
+
+	TP_printk("minor=%d bytes=%zu queued=%zu",
+		__entry->minor, __entry->bytes, __entry->queued)
+);
+
+DEFINE_EVENT(pktstrm_data, pktstrm_enqueue,
+	TP_PROTO(int minor, size_t bytes, size_t queued),
+	TP_ARGS(minor, bytes, queued)
+);
+
+DEFINE_EVENT(pktstrm_data, pktstrm_dequeue,
+	TP_PROTO(int minor, size_t bytes, size_t queued),
+	TP_ARGS(minor, bytes, queued)
+);
+
+/*
+ * A packet read in part by a stream read, its residual stays queued
+ */
+TRACE_EVENT(pktstrm_split,
+
+	TP_PROTO(int minor, size_t bytes, size_t residual),
+
+	TP_ARGS(minor, bytes, residual),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(size_t, bytes)
+		__field(size_t, residual)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->bytes = bytes;
+		__entry->residual = residual;
+	),
+
+	TP_printk("minor=%d bytes=%zu residual=%zu",
+		__entry->minor, __entry->bytes, __entry->residual)
+);
+
+/*
+ * Bytes of a packet not fitting in the buffer of a packet read
+ */
+TRACE_EVENT(pktstrm_drop,
+
+	TP_PROTO(int minor, size_t bytes),
+
+	TP_ARGS(minor, bytes),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(size_t, bytes)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->bytes = bytes;
+	),
+
+	TP_printk("minor=%d bytes=%zu", __entry->minor, __entry->bytes)
+);
+
+/*
+ * Packets evicted from the head of a minor to make room for a write
+ */
+TRACE_EVENT(pktstrm_evict,
+
+	TP_PROTO(int minor, size_t pkts, size_t bytes),
+
+	TP_ARGS(minor, pkts, bytes),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(size_t, pkts)
+		__field(size_t, bytes)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->pkts = pkts;
+		__entry->bytes = bytes;
+	),
+
+	TP_printk("minor=%d pkts=%zu bytes=%zu",
+		__entry->minor, __entry->pkts, __entry->bytes)
+);
+
+/*
+ * A client going to sleep waiting for data, or for space for a number of
+ * bytes, and the same client waking up
+ */
+TRACE_EVENT(pktstrm_block,
+
+	TP_PROTO(int minor, bool writer, size_t bytes),
+
+	TP_ARGS(minor, writer, bytes),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(bool, writer)
+		__field(size_t, bytes)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->writer = writer;
+		__entry->bytes = bytes;
+	),
+
+	TP_printk("minor=%d %s bytes=%zu", __entry->minor,
+		__entry->writer ? "writer" : "reader", __entry->bytes)
+);
+
+TRACE_EVENT(pktstrm_wakeup,
+
+	TP_PROTO(int minor, bool writer, int interrupted),
+
+	TP_ARGS(minor, writer, interrupted),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(bool, writer)
+		__field(int, interrupted)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->writer = writer;
+		__entry->interrupted = interrupted;
+	),
+
+	TP_printk("minor=%d %s interrupted=%d", __entry->minor,
+		__entry->writer ? "writer" : "reader", __entry->interrupted)
+);
+
+#endif /* PKTSTREAM_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pktstream_trace
+#include <trace/define_trace.h>
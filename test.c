@@ -1,12 +1,26 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/uio.h>
 #include "pktstream_lib.h"
 
 #define BUF_SIZE 4096
+#define SPLIT_SEGMENTS 8
+#define LARGE_PKT_SIZE 262144
+#define LARGE_IOVECS 4
+#define LOAD_MAGIC 0x706b7473
+#define LOAD_MAX_MINORS 1024
+#define LOAD_MAX_CPUS 256
+#define LOAD_MAX_SIZES 32
 
 
 /*
@@ -98,7 +112,680 @@ void read_to_empty(char * read_char){
 }
 
 
-int main() {
+/**
+ * test partial consumption of large segments in stream mode
+ * the time per read must not depend on the residual left in the segment
+ * */
+void test_split_reads(char * read_char){
+	char * to_write;
+	int chunk;
+	int reads;
+	int read_size;
+	int total;
+	struct timespec start;
+	struct timespec end;
+	double elapsed;
+
+	to_write = malloc(BUF_SIZE * SPLIT_SEGMENTS);
+	memset(to_write, 'x', BUF_SIZE * SPLIT_SEGMENTS);
+	set_mode_stream(fd0);
+	set_packet_size(fd0, BUF_SIZE);
+
+	for (chunk = 1; chunk <= BUF_SIZE; chunk *= 2) {
+		write(fd0, to_write, BUF_SIZE * SPLIT_SEGMENTS);
+
+		reads = 0;
+		total = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		while (total < BUF_SIZE * SPLIT_SEGMENTS) {
+			read_size = read(fd0, read_char, chunk);
+			if (read_size <= 0)
+				break;
+			total += read_size;
+			reads++;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		printf("Chunk %4d bytes: %6d reads, %8.1f ns per read\n", chunk, reads, elapsed / reads);
+	}
+
+	memset(read_char, 0, BUF_SIZE);
+	free(to_write);
+}
+
+
+/**
+ * test in place production on the mapped ring, consumed with read
+ * */
+void test_ring_map(char * to_write, int size, char * read_char){
+	ring_map map;
+	byte * slot;
+	int read_size;
+
+	if (map_ring(fd1, &map) != 0)
+		return;
+
+	set_mode_packet(fd1);
+	slot = ring_write_begin(&map, size);
+	if (slot == NULL) {
+		printf("Ring full\n");
+	} else {
+		memcpy(slot, to_write, size);
+		ring_write_commit(&map, size);
+		read_size = read(fd1, read_char, BUF_SIZE);
+		printf("Bytes read: %d, Content: %s\n", read_size, read_char);
+		memset(read_char, 0, BUF_SIZE);
+	}
+
+	unmap_ring(&map);
+}
+
+
+/**
+ * test readiness reported by poll before and after a write
+ * */
+void test_poll(char * to_write, int size, char * read_char){
+	struct pollfd pfd;
+
+	pfd.fd = fd0;
+	pfd.events = POLLIN | POLLOUT;
+
+	poll(&pfd, 1, 0);
+	printf("Empty file: readable %d, writable %d\n", !!(pfd.revents & POLLIN), !!(pfd.revents & POLLOUT));
+
+	write(fd0, to_write, size);
+	poll(&pfd, 1, 0);
+	printf("After write: readable %d, writable %d\n", !!(pfd.revents & POLLIN), !!(pfd.revents & POLLOUT));
+
+	read_to_empty(read_char);
+}
+
+
+/**
+ * test batched reads of the packets of a single write
+ * */
+void test_batch(char * to_write, int size, char * read_char){
+	unsigned int lengths[64];
+	int num_pkts;
+	int i;
+
+	write(fd0, to_write, size);
+	num_pkts = read_batch(fd0, read_char, BUF_SIZE, lengths, 64);
+	printf("Packets read: %d\n", num_pkts);
+	for (i = 0; i < num_pkts; i++)
+		printf("Packet %d: %u bytes\n", i, lengths[i]);
+	memset(read_char, 0, BUF_SIZE);
+}
+
+
+/**
+ * test readiness reported by poll against the read low watermark
+ * */
+void test_lowat(char * to_write, int size, char * read_char){
+	struct pollfd pfd;
+
+	pfd.fd = fd0;
+	pfd.events = POLLIN;
+	set_read_lowat(fd0, 2 * size);
+
+	write(fd0, to_write, size);
+	poll(&pfd, 1, 0);
+	printf("Below watermark: readable %d\n", !!(pfd.revents & POLLIN));
+
+	write(fd0, to_write, size);
+	poll(&pfd, 1, 0);
+	printf("At watermark: readable %d\n", !!(pfd.revents & POLLIN));
+
+	set_read_lowat(fd0, 1);
+	read_to_empty(read_char);
+}
+
+
+/**
+ * test two sessions of the same minor both receiving a broadcast packet
+ * */
+void test_broadcast(char * to_write, int size, char * read_char){
+	int fd_sub;
+	int read_size;
+
+	fd_sub = open("/dev/pktstrm0", O_RDWR | O_NONBLOCK);
+	set_broadcast(fd0, 1);
+
+	write(fd0, to_write, size);
+	read_size = read(fd0, read_char, BUF_SIZE);
+	printf("First subscriber: %d bytes, Content: %s\n", read_size, read_char);
+	memset(read_char, 0, BUF_SIZE);
+	read_size = read(fd_sub, read_char, BUF_SIZE);
+	printf("Second subscriber: %d bytes, Content: %s\n", read_size, read_char);
+	memset(read_char, 0, BUF_SIZE);
+
+	set_broadcast(fd0, 0);
+	close(fd_sub);
+}
+
+
+/**
+ * test forwarding a packet through a pipe with splice
+ * */
+void test_splice(char * to_write, int size, char * read_char){
+	int pipe_fds[2];
+	ssize_t moved;
+
+	if (pipe(pipe_fds) != 0) {
+		printf("can't create pipe\n");
+		return;
+	}
+
+	write(fd0, to_write, size);
+	moved = splice(fd0, NULL, pipe_fds[1], NULL, BUF_SIZE, 0);
+	printf("Spliced to pipe: %zd bytes\n", moved);
+	moved = splice(pipe_fds[0], NULL, fd1, NULL, moved, 0);
+	printf("Spliced from pipe: %zd bytes\n", moved);
+
+	read(fd1, read_char, BUF_SIZE);
+	printf("Forwarded: %s\n", read_char);
+	memset(read_char, 0, BUF_SIZE);
+
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+}
+
+
+/**
+ * test writes larger than the free space on a non-blocking session: a write
+ * above the atomic size is queued in part, one below it whole or not at all
+ * */
+void test_partial_write(char * to_write, int size, char * read_char){
+	int write_size;
+
+	set_file_size(fd0, 64);
+	set_atomic_size(fd0, 48);
+
+	write_size = write(fd0, to_write, size);
+	printf("Partial write: %d of %d bytes\n", write_size, size);
+	write_size = write(fd0, to_write, size);
+	printf("Write on full file: %d, errno %d\n", write_size, errno);
+	read_to_empty(read_char);
+
+	write_size = write(fd0, to_write, 40);
+	printf("Atomic write: %d bytes\n", write_size);
+	write_size = write(fd0, to_write, 40);
+	printf("Atomic write not fitting: %d, errno %d\n", write_size, errno);
+	read_to_empty(read_char);
+
+	set_file_size(fd0, FILE_DEFAULT_SIZE);
+	set_atomic_size(fd0, ATOMIC_DEFAULT_SIZE);
+}
+
+
+/**
+ * test packets larger than the segment caches, read back whole with a
+ * single scattering read
+ * */
+void test_large_packets(void){
+	struct iovec iov[LARGE_IOVECS];
+	char * to_write;
+	char * to_read;
+	ssize_t size;
+	int i;
+
+	to_write = malloc(LARGE_PKT_SIZE);
+	to_read = malloc(LARGE_PKT_SIZE);
+	for (i = 0; i < LARGE_PKT_SIZE; i++)
+		to_write[i] = 'a' + i % 26;
+
+	set_mode_packet(fd0);
+	set_file_size(fd0, 4 * LARGE_PKT_SIZE);
+	set_packet_size(fd0, LARGE_PKT_SIZE);
+
+	size = write(fd0, to_write, LARGE_PKT_SIZE);
+	printf("Bytes written: %zd\n", size);
+
+	for (i = 0; i < LARGE_IOVECS; i++) {
+		iov[i].iov_base = to_read + i * (LARGE_PKT_SIZE / LARGE_IOVECS);
+		iov[i].iov_len = LARGE_PKT_SIZE / LARGE_IOVECS;
+	}
+	size = readv(fd0, iov, LARGE_IOVECS);
+	printf("Bytes read: %zd, Matching: %d\n", size, memcmp(to_write, to_read, LARGE_PKT_SIZE) == 0);
+
+	set_packet_size(fd0, 16);
+	set_file_size(fd0, FILE_DEFAULT_SIZE);
+	free(to_write);
+	free(to_read);
+}
+
+
+/**
+ * test packets written with segments pinned to node 0, then following the
+ * reader; remote_bytes in debugfs counts the copies across nodes
+ * */
+void test_numa_node(char * to_write, int size, char * read_char){
+	int read_size;
+
+	if (set_numa_node(fd0, 0) == 0) {
+		write(fd0, to_write, size);
+		read_size = read(fd0, read_char, BUF_SIZE);
+		printf("Pinned to node 0: %d bytes, Content: %s\n", read_size, read_char);
+		memset(read_char, 0, BUF_SIZE);
+	}
+
+	set_numa_node(fd0, PKTSTRM_NUMA_FOLLOW);
+	write(fd0, to_write, size);
+	read_size = read(fd0, read_char, BUF_SIZE);
+	printf("Following reader: %d bytes, Content: %s\n", read_size, read_char);
+	memset(read_char, 0, BUF_SIZE);
+}
+
+
+/**
+ * test a full file evicting its oldest packet for a new one, then failing
+ * a write without sleeping
+ * */
+void test_overflow(char * read_char){
+	pktstrm_drops drops;
+	char pkt[16];
+	int write_size;
+	int read_size;
+	int i;
+
+	set_file_size(fd0, 4 * sizeof(pkt));
+	set_overflow(fd0, OVERFLOW_DROP_OLDEST);
+	for (i = 0; i < 5; i++) {
+		memset(pkt, '0' + i, sizeof(pkt));
+		write(fd0, pkt, sizeof(pkt));
+	}
+	get_drops(fd0, &drops);
+	printf("Dropped: %lu packets, %lu bytes\n", drops.pkts, drops.bytes);
+	read_size = read(fd0, read_char, BUF_SIZE);
+	printf("Oldest left: %d bytes, Content: %s\n", read_size, read_char);
+	memset(read_char, 0, BUF_SIZE);
+
+	set_overflow(fd0, OVERFLOW_FAIL);
+	write(fd0, pkt, sizeof(pkt));
+	write_size = write(fd0, pkt, sizeof(pkt));
+	printf("Write on full file: %d, errno %d\n", write_size, errno);
+
+	set_overflow(fd0, OVERFLOW_BLOCK);
+	read_to_empty(read_char);
+	set_file_size(fd0, FILE_DEFAULT_SIZE);
+}
+
+
+/**
+ * test the lock-free path of a single producer and a single consumer, with
+ * the packet size changed between two writes
+ * */
+void test_spsc(char * to_write, int size, char * read_char){
+	set_spsc(fd0, 1);
+	write(fd0, to_write, size);
+	set_packet_size(fd0, 4);
+	write(fd0, to_write, size);
+	read_to_empty(read_char);
+	set_spsc(fd0, 0);
+}
+
+
+/**
+ * test urgent packets overtaking bulk ones queued before them, and lanes
+ * read in order of priority
+ * */
+void test_lanes(char * to_write, int size, char * read_char){
+	int read_size;
+
+	write(fd0, to_write, size);
+	set_lane(fd0, 1);
+	write(fd0, "middle ", 7);
+	set_lane(fd0, PKTSTRM_LANES - 1);
+	write(fd0, "urgent ", 7);
+	set_lane(fd0, 0);
+
+	read_size = read(fd0, read_char, BUF_SIZE);
+	printf("First read: %d bytes, Content: %s\n", read_size, read_char);
+	memset(read_char, 0, BUF_SIZE);
+	read_to_empty(read_char);
+}
+
+
+/**
+ * Load generator
+ * producers and consumers on one or more minors, each with its own session;
+ * every packet carries the time it was written, consumers measure the
+ * end-to-end latency from it
+ * */
+typedef struct load_header {
+	unsigned int magic;
+	unsigned int size;
+	unsigned long sent_ns;
+} load_header;
+
+typedef struct load_config {
+	int minors;
+	int producers;
+	int consumers;
+	long cpus[LOAD_MAX_CPUS];
+	int num_cpus;
+	long sizes[LOAD_MAX_SIZES];
+	int num_sizes;
+	int stream;
+	int non_blocking;
+	int duration;
+} load_config;
+
+typedef struct load_thread {
+	pthread_t thread;
+	load_config *config;
+	int minor;
+	size_t pkt_size;
+	int done;
+
+	// messages and bytes moved, operations finding no data or space,
+	// and stream reads not starting at a packet boundary
+	unsigned long msgs;
+	unsigned long bytes;
+	unsigned long would_block;
+	unsigned long unframed;
+
+	// end-to-end latency, consumers only
+	histogram latency;
+} load_thread;
+
+volatile int load_stop;
+
+unsigned long now_ns(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/** signals only interrupt blocking reads and writes at the end of a run */
+void load_interrupt(int signum){
+}
+
+int open_minor(load_config *config, int minor){
+	char path[32];
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/pktstrm%d", minor);
+	fd = open(path, O_RDWR | (config->non_blocking ? O_NONBLOCK : 0));
+	if (fd < 0) {
+		printf("can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (config->stream)
+		set_mode_stream(fd);
+	else
+		set_mode_packet(fd);
+	return fd;
+}
+
+void *load_producer(void *arg){
+	load_thread *lt = arg;
+	load_header *header;
+	char *buff;
+	int write_size;
+	int fd;
+
+	fd = open_minor(lt->config, lt->minor);
+	buff = malloc(lt->pkt_size);
+	memset(buff, 'x', lt->pkt_size);
+	header = (load_header *) buff;
+	header->magic = LOAD_MAGIC;
+	header->size = lt->pkt_size;
+
+	while (fd >= 0 && !load_stop) {
+		header->sent_ns = now_ns();
+		write_size = write(fd, buff, lt->pkt_size);
+		if (write_size > 0) {
+			lt->msgs++;
+			lt->bytes += write_size;
+		} else if (write_size == 0 || errno == EAGAIN) {
+			lt->would_block++;
+		}
+	}
+
+	free(buff);
+	if (fd >= 0)
+		close(fd);
+	__atomic_store_n(&lt->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void *load_consumer(void *arg){
+	load_thread *lt = arg;
+	load_header *header;
+	char *buff;
+	int read_size;
+	unsigned long now;
+	int fd;
+
+	fd = open_minor(lt->config, lt->minor);
+	buff = malloc(lt->pkt_size);
+	header = (load_header *) buff;
+
+	while (fd >= 0 && !load_stop) {
+		read_size = read(fd, buff, lt->pkt_size);
+		if (read_size <= 0) {
+			if (read_size == 0 || errno == EAGAIN)
+				lt->would_block++;
+			continue;
+		}
+		now = now_ns();
+		lt->bytes += read_size;
+		if (!lt->config->stream)
+			lt->msgs++;
+
+		// a stream read may start in the middle of a packet
+		if (read_size == lt->pkt_size && header->magic == LOAD_MAGIC && header->size == lt->pkt_size && header->sent_ns <= now)
+			hist_record(&lt->latency, now - header->sent_ns);
+		else
+			lt->unframed++;
+	}
+	if (lt->config->stream)
+		lt->msgs = lt->bytes / lt->pkt_size;
+
+	free(buff);
+	if (fd >= 0)
+		close(fd);
+	__atomic_store_n(&lt->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/** empty a minor between runs, so that the next run starts framed */
+void drain_minor(int fd, char *buff){
+	while (read(fd, buff, BUF_SIZE) > 0)
+		;
+}
+
+/**
+ * run the producers and consumers of every minor for the configured
+ * duration with packets of pkt_size bytes
+ * */
+void load_run(load_config *config, size_t pkt_size, int *control_fds, char *drain_buff){
+	load_thread *threads;
+	histogram latency;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	unsigned long start;
+	unsigned long elapsed;
+	unsigned long msgs;
+	unsigned long bytes;
+	unsigned long would_block;
+	unsigned long unframed;
+	int per_minor;
+	int num_threads;
+	int i;
+
+	per_minor = config->producers + config->consumers;
+	num_threads = config->minors * per_minor;
+	threads = calloc(num_threads, sizeof(load_thread));
+
+	for (i = 0; i < config->minors; i++)
+		set_packet_size(control_fds[i], pkt_size);
+
+	load_stop = 0;
+	start = now_ns();
+	for (i = 0; i < num_threads; i++) {
+		threads[i].config = config;
+		threads[i].minor = i / per_minor;
+		threads[i].pkt_size = pkt_size;
+
+		// threads are pinned round robin on the given cpus
+		pthread_attr_init(&attr);
+		if (config->num_cpus > 0) {
+			CPU_ZERO(&cpus);
+			CPU_SET(config->cpus[i % config->num_cpus], &cpus);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus);
+		}
+		pthread_create(&threads[i].thread, &attr, i % per_minor < config->producers ? load_producer : load_consumer, &threads[i]);
+		pthread_attr_destroy(&attr);
+	}
+
+	sleep(config->duration);
+	load_stop = 1;
+	elapsed = now_ns() - start;
+
+	// blocked clients are woken by a signal, repeated in case it arrives
+	// right before they go to sleep
+	for (i = 0; i < num_threads; i++) {
+		while (!__atomic_load_n(&threads[i].done, __ATOMIC_ACQUIRE)) {
+			pthread_kill(threads[i].thread, SIGUSR1);
+			usleep(1000);
+		}
+		pthread_join(threads[i].thread, NULL);
+	}
+
+	memset(&latency, 0, sizeof(latency));
+	msgs = 0;
+	bytes = 0;
+	would_block = 0;
+	unframed = 0;
+	for (i = 0; i < num_threads; i++) {
+		would_block += threads[i].would_block;
+		if (i % per_minor < config->producers)
+			continue;
+		msgs += threads[i].msgs;
+		bytes += threads[i].bytes;
+		unframed += threads[i].unframed;
+		hist_merge(&latency, &threads[i].latency);
+	}
+
+	printf("Packet size %zu: %.0f msgs/s, %.3f GB/s, %lu would block, %lu unframed reads\n",
+		pkt_size, msgs * 1e9 / elapsed, (double) bytes / elapsed, would_block, unframed);
+	hist_print(&latency, "latency ns");
+
+	for (i = 0; i < config->minors; i++)
+		drain_minor(control_fds[i], drain_buff);
+	free(threads);
+}
+
+/** parse a comma separated list of numbers, returns how many were read */
+int parse_list(char *list, long *values, int max){
+	char *token;
+	int num;
+
+	num = 0;
+	for (token = strtok(list, ","); token != NULL && num < max; token = strtok(NULL, ","))
+		values[num++] = strtol(token, NULL, 10);
+	return num;
+}
+
+void load_usage(char *name){
+	printf("usage: %s [-m minors] [-p producers] [-c consumers] [-a cpu,...] [-s size,...] [-S] [-n] [-d seconds]\n", name);
+	printf("  -m  minors to load, /dev/pktstrm0 onwards (default 1)\n");
+	printf("  -p  producer threads per minor (default 1)\n");
+	printf("  -c  consumer threads per minor (default 1)\n");
+	printf("  -a  cpus to pin threads to, round robin (default none)\n");
+	printf("  -s  packet sizes to sweep, %zu to %d bytes (default 64,256,1024,4096)\n", sizeof(load_header), BUF_SIZE);
+	printf("  -S  stream mode (default packet)\n");
+	printf("  -n  non-blocking access (default blocking)\n");
+	printf("  -d  seconds of each packet size (default 5)\n");
+}
+
+/**
+ * run the load generator with the options on the command line
+ * */
+int load_main(int argc, char **argv){
+	load_config config;
+	struct sigaction sa;
+	int control_fds[LOAD_MAX_MINORS];
+	char *drain_buff;
+	int opt;
+	int i;
+
+	memset(&config, 0, sizeof(config));
+	config.minors = 1;
+	config.producers = 1;
+	config.consumers = 1;
+	config.sizes[0] = 64;
+	config.sizes[1] = 256;
+	config.sizes[2] = 1024;
+	config.sizes[3] = 4096;
+	config.num_sizes = 4;
+	config.duration = 5;
+
+	while ((opt = getopt(argc, argv, "m:p:c:a:s:Snd:h")) != -1) {
+		switch (opt) {
+		case 'm': config.minors = atoi(optarg); break;
+		case 'p': config.producers = atoi(optarg); break;
+		case 'c': config.consumers = atoi(optarg); break;
+		case 'a': config.num_cpus = parse_list(optarg, config.cpus, LOAD_MAX_CPUS); break;
+		case 's': config.num_sizes = parse_list(optarg, config.sizes, LOAD_MAX_SIZES); break;
+		case 'S': config.stream = 1; break;
+		case 'n': config.non_blocking = 1; break;
+		case 'd': config.duration = atoi(optarg); break;
+		default:
+			load_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (config.minors < 1 || config.minors > LOAD_MAX_MINORS || config.producers < 1 ||
+			config.consumers < 1 || config.duration < 1 || config.num_sizes < 1) {
+		load_usage(argv[0]);
+		return 1;
+	}
+	for (i = 0; i < config.num_sizes; i++) {
+		if (config.sizes[i] < (long) sizeof(load_header) || config.sizes[i] > BUF_SIZE) {
+			load_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// no SA_RESTART, so that blocked reads and writes return
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = load_interrupt;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	for (i = 0; i < config.minors; i++) {
+		control_fds[i] = open_minor(&config, i);
+		if (control_fds[i] < 0)
+			return 1;
+		set_access_non_blocking(control_fds[i]);
+	}
+	drain_buff = malloc(BUF_SIZE);
+
+	printf("%d minors, %d producers and %d consumers each, %s mode, %s access, %d s per size\n",
+		config.minors, config.producers, config.consumers, config.stream ? "stream" : "packet",
+		config.non_blocking ? "non-blocking" : "blocking", config.duration);
+	for (i = 0; i < config.num_sizes; i++) {
+		printf("------------------------------------------------------------\n");
+		load_run(&config, config.sizes[i], control_fds, drain_buff);
+	}
+
+	for (i = 0; i < config.minors; i++)
+		close(control_fds[i]);
+	free(drain_buff);
+	return 0;
+}
+
+
+/**
+ * without arguments run the functional tests on minors 0 and 1,
+ * with any option run the load generator
+ * */
+int main(int argc, char **argv) {
 	int read_size;
 	int write_size;
 	int loerm_size;
@@ -111,14 +798,18 @@ int main() {
 	lorem = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum.";
 	loerm_size = strlen(lorem);
 
+	if (argc > 1)
+		return load_main(argc, argv);
+
 	read_char = malloc(BUF_SIZE);
 	
 	to_write1 = "test1 ";
 	to_write2 = "test2 ";
 
-	// opening device files with minor numbers 0 and 1
-	fd0 = open("devfile", O_RDWR);
-	fd1 = open("devfile1", O_RDWR);
+	// opening device files with minor numbers 0 and 1, reads on an
+	// empty file must return instead of sleeping
+	fd0 = open("/dev/pktstrm0", O_RDWR | O_NONBLOCK);
+	fd1 = open("/dev/pktstrm1", O_RDWR | O_NONBLOCK);
 	printf("file descriptors: %d - %d\n", fd0, fd1);
 	
 	test_packet(lorem, loerm_size, read_char);
@@ -154,6 +845,103 @@ int main() {
 	set_mode_stream(fd1);
 	test_stream(lorem, loerm_size, read_char);
 
+	printf("------------------------------------------------------------\n");
+	printf("Testing batched packet reads\n");
+
+	test_batch(lorem, loerm_size, read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing broadcast to two sessions\n");
+
+	test_broadcast(to_write1, strlen(to_write1), read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing splice through a pipe\n");
+
+	test_splice(to_write1, strlen(to_write1), read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing poll readiness\n");
+
+	set_access_non_blocking(fd0);
+	test_poll(to_write1, strlen(to_write1), read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing read low watermark\n");
+
+	test_lowat(to_write1, strlen(to_write1), read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing split reads over %d byte segments\n", BUF_SIZE);
+
+	test_split_reads(read_char);
+	set_packet_size(fd0, 16);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing partial writes above the atomic size\n");
+
+	set_mode_stream(fd0);
+	test_partial_write(lorem, loerm_size, read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing %d byte packets\n", LARGE_PKT_SIZE);
+
+	test_large_packets();
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing priority lanes\n");
+
+	set_mode_stream(fd0);
+	test_lanes(to_write1, strlen(to_write1), read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing overflow policies of a full file\n");
+
+	set_mode_packet(fd0);
+	test_overflow(read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing segments placed on a memory node\n");
+
+	set_mode_packet(fd0);
+	test_numa_node(to_write1, strlen(to_write1), read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing lock-free single producer single consumer\n");
+
+	set_mode_packet(fd0);
+	test_spsc(to_write1, strlen(to_write1), read_char);
+	set_packet_size(fd0, 16);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing preallocated segment pools\n");
+
+	set_mode_packet(fd0);
+	set_mode_packet(fd1);
+	set_prealloc(fd0, 1);
+	set_prealloc(fd1, 1);
+	test_packet(lorem, loerm_size, read_char);
+	set_prealloc(fd0, 0);
+	set_prealloc(fd1, 0);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing ring storage engine\n");
+
+	set_engine_ring(fd0);
+	set_engine_ring(fd1);
+	set_mode_packet(fd0);
+	set_mode_packet(fd1);
+
+	test_packet(lorem, loerm_size, read_char);
+	set_mode_stream(fd0);
+	set_mode_stream(fd1);
+	test_stream(lorem, loerm_size, read_char);
+
+	printf("------------------------------------------------------------\n");
+	printf("Testing in place access to the mapped ring\n");
+
+	test_ring_map(lorem, loerm_size, read_char);
+
 	close(fd0);
 	close(fd1);
 	return 0;